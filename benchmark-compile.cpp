@@ -0,0 +1,60 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* A file using the most common plotting functions, which "make
+ * benchmark-compile" compiles in the default header-only mode and in
+ * the compiled mode (see GNUPLOTPP_COMPILED in gplot++.h).
+ * When compiled with GNUPLOTPP_IMPLEMENTATION, it provides the
+ * templates needed by the other files and can be linked as a program.
+ */
+
+#include "gplot++.h"
+
+void plot_everything(Gnuplot &plt) {
+  std::vector<double> xd{1, 2, 3}, yd{4, 5, 6}, zd{7, 8, 9};
+  std::vector<float> xf{1, 2, 3}, yf{4, 5, 6}, zf{7, 8, 9};
+  std::vector<int> xi{1, 2, 3}, yi{4, 5, 6}, zi{7, 8, 9};
+
+  plt.plot(yd);
+  plt.plot(xd, yd);
+  plt.plot(yf);
+  plt.plot(xf, yf);
+  plt.plot(yi);
+  plt.plot(xi, yi);
+  plt.show();
+
+  plt.plot3d(xd, yd, zd);
+  plt.plot3d(xf, yf, zf);
+  plt.plot3d(xi, yi, zi);
+  plt.show();
+
+  plt.histogram(yd, 2);
+  plt.histogram(yf, 2);
+  plt.histogram(yi, 2);
+  plt.show();
+}
+
+int main() {
+  Gnuplot plt{};
+  plot_everything(plt);
+}
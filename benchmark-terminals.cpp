@@ -0,0 +1,150 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Measure how long the local Gnuplot takes to render the same plot
+ * with each of the terminals used by Gnuplot::redirect_to_png, so
+ * that the choice of a Gnuplot::Quality can be based on numbers.
+ *
+ * Usage: benchmark-terminals [GNUPLOT_EXECUTABLE [NUM_POINTS [NUM_RUNS]]]
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+struct Terminal {
+  std::string name;
+  std::string command;
+};
+
+// Run Gnuplot on a script and return the elapsed time in seconds, or
+// a negative number if Gnuplot failed
+double run_gnuplot(const std::string &executable, const std::string &script) {
+  auto start = std::chrono::steady_clock::now();
+
+  FILE *pipe = popen((executable + " 2> /dev/null").c_str(), "w");
+  if (!pipe)
+    return -1.0;
+
+  fputs(script.c_str(), pipe);
+  if (pclose(pipe) != 0)
+    return -1.0;
+
+  std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                        start};
+  return elapsed.count();
+}
+
+// Create an empty temporary file and return its name, or an empty
+// string if the file could not be created
+std::string make_temp_file() {
+  char name[] = "/tmp/benchmark-terminals-XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0)
+    return "";
+
+  close(fd);
+  return name;
+}
+
+double best_time(const std::string &executable, const std::string &script,
+                 int num_runs) {
+  double best{-1.0};
+  for (int i{}; i < num_runs; ++i) {
+    double t = run_gnuplot(executable, script);
+    if (t < 0)
+      return -1.0;
+
+    if (best < 0 || t < best)
+      best = t;
+  }
+
+  return best;
+}
+
+int main(int argc, const char *argv[]) {
+  std::string executable{argc > 1 ? argv[1] : "gnuplot"};
+  int num_points{argc > 2 ? std::atoi(argv[2]) : 100000};
+  int num_runs{argc > 3 ? std::atoi(argv[3]) : 5};
+
+  std::string data_file{make_temp_file()};
+  std::string output_file{make_temp_file()};
+  if (data_file.empty() || output_file.empty()) {
+    std::cerr << "Unable to create temporary files\n";
+    std::remove(data_file.c_str());
+    std::remove(output_file.c_str());
+    return 1;
+  }
+
+  {
+    std::ofstream of{data_file};
+    for (int i{}; i < num_points; ++i)
+      of << i << " " << std::sin(i * 0.01) + 0.1 * std::sin(i * 1.3) << "\n";
+  }
+
+  const std::vector<Terminal> terminals{
+      {"png (DRAFT)", "set terminal png size 800,600"},
+      {"png tiny 160x120 (thumbnail)", "set terminal png tiny size 160,120"},
+      {"pngcairo (NORMAL)", "set terminal pngcairo color enhanced size 800,600"},
+      {"pngcairo (PUBLICATION)", "set terminal pngcairo color enhanced rounded "
+                                 "linewidth 1.5 size 800,600"},
+      {"pbm (raw pixels)", "set terminal pbm color small size 800,600"},
+  };
+
+  std::string plot_cmd{"plot '" + data_file + "' using 1:2 with lines\n"};
+
+  // The time needed to start Gnuplot and read the data must be
+  // subtracted from each measurement
+  double baseline =
+      best_time(executable, "set terminal unknown\n" + plot_cmd, num_runs);
+  if (baseline < 0) {
+    std::cerr << "Unable to run \"" << executable << "\"\n";
+    std::remove(data_file.c_str());
+    std::remove(output_file.c_str());
+    return 1;
+  }
+
+  std::cout << "Gnuplot startup + data loading (" << num_points
+            << " points): " << baseline * 1e3 << " ms\n\n";
+  for (const auto &term : terminals) {
+    double t = best_time(executable,
+                         term.command + "\nset output '" + output_file +
+                             "'\n" + plot_cmd,
+                         num_runs);
+
+    std::cout << term.name << ": ";
+    if (t < 0)
+      std::cout << "not available\n";
+    else
+      std::cout << (t - baseline) * 1e3 << " ms per render\n";
+  }
+
+  std::remove(data_file.c_str());
+  std::remove(output_file.c_str());
+}
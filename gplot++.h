@@ -35,26 +35,451 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 // The "sleep" function is non-standard
 #ifdef _WIN32
 #include <Windows.h>
+#include <direct.h>
 #else
 #include <unistd.h>
 #endif
 
+// Used to manage the Gnuplot process and to wait for plots
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+// Connections to a render daemon use Linux-specific features
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define GNUPLOTPP_HAS_DAEMON_CLIENT
+#endif
+
 const unsigned GNUPLOTPP_VERSION = 0x000201;
 const unsigned GNUPLOTPP_MAJOR_VERSION = (GNUPLOTPP_VERSION & 0xFF0000) >> 16;
 const unsigned GNUPLOTPP_MINOR_VERSION = (GNUPLOTPP_VERSION & 0x00FF00) >> 8;
 const unsigned GNUPLOTPP_PATCH_VERSION = (GNUPLOTPP_VERSION & 0xFF);
 
+/**
+ * Timeline of the operations done by all the Gnuplot objects
+ *
+ * If the macro GNUPLOTPP_ENABLE_TRACING is defined before including
+ * this file, the Gnuplot class records how long it takes to format and
+ * write the data of each series, to send commands, and to render each
+ * plot. Call `GnuplotTrace::save` to write all the events recorded so
+ * far in a JSON file that can be loaded in chrome://tracing or
+ * https://ui.perfetto.dev. When the macro is not defined, no code is
+ * generated to record events. The functions that store the events
+ * are compiled with GNUPLOTPP_IMPLEMENTATION (see below), which must
+ * be defined in one file of a program enabling the tracing.
+ */
+class GnuplotTrace {
+public:
+  // Record the time spent between its creation and its destruction
+  class Span {
+  public:
+    Span(const char *name, const std::string &tag)
+        : name{name}, tag{tag}, start{std::chrono::steady_clock::now()} {}
+
+    ~Span() {
+      GnuplotTrace::record(name, tag, start, std::chrono::steady_clock::now());
+    }
+
+  private:
+    const char *name;
+    std::string tag;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  static void record(const char *name, const std::string &tag,
+                     std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end);
+
+  /* Save the events recorded so far in a file using the Chrome trace
+     format. Return `false` if the file could not be written. */
+  static bool save(const std::string &filename);
+
+  // Forget all the events recorded so far
+  static void clear();
+
+  /* Escape `s` so that it can be put within double quotes in a JSON
+     file; control characters are replaced by spaces */
+  static std::string escape_json(const std::string &s) {
+    std::string result;
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        result.push_back('\\');
+
+      if (static_cast<unsigned char>(c) < 0x20)
+        result.push_back(' ');
+      else
+        result.push_back(c);
+    }
+
+    return result;
+  }
+
+private:
+  struct Event {
+    const char *name;
+    std::string tag;
+    std::chrono::steady_clock::time_point start, end;
+    int thread_index;
+  };
+
+  // Events recorded so far, defined together with `record`
+  struct State;
+  static State &get_state();
+};
+
+#define GNUPLOTPP_CONCAT_(a, b) a##b
+#define GNUPLOTPP_CONCAT(a, b) GNUPLOTPP_CONCAT_(a, b)
+
+#ifdef GNUPLOTPP_ENABLE_TRACING
+#define GNUPLOTPP_TRACE_SPAN(name, tag)                                        \
+  GnuplotTrace::Span GNUPLOTPP_CONCAT(gnuplotpp_span_, __LINE__) { name, tag }
+#else
+#define GNUPLOTPP_TRACE_SPAN(name, tag)
+#endif
+
+/**
+ * Histogram of latencies with logarithmic buckets
+ *
+ * Each power of two (in microseconds) is split into four buckets, so
+ * that percentiles are accurate within ~12%. Recording a value only
+ * requires a few atomic operations, so the same histogram can be
+ * updated by many threads without locks, and histograms filled
+ * separately can be merged. (`GnuplotLatencyStats` only locks when a
+ * category is recorded for the first time.)
+ */
+class GnuplotLatencyHistogram {
+public:
+  static constexpr size_t NUM_BUCKETS = 192;
+
+  // Copy of the state of a histogram at some time
+  struct Snapshot {
+    std::vector<unsigned long long> counts;
+    unsigned long long count;
+    double sum_seconds, min_seconds, max_seconds;
+
+    double mean() const { return count > 0 ? sum_seconds / count : 0.0; }
+
+    /* Return an estimate of the `p`-th percentile (0 ≤ p ≤ 100) of the
+       latencies, in seconds */
+    double percentile(double p) const {
+      if (count == 0)
+        return 0.0;
+
+      const double rank{std::max(1.0, std::ceil(p / 100.0 * count))};
+      unsigned long long cumulative{};
+      for (size_t i{}; i < counts.size(); ++i) {
+        cumulative += counts[i];
+        if (cumulative >= rank) {
+          double mid{0.5 * (bucket_lower_us(i) + bucket_upper_us(i)) * 1e-6};
+          return std::min(max_seconds, std::max(min_seconds, mid));
+        }
+      }
+
+      return max_seconds;
+    }
+  };
+
+  GnuplotLatencyHistogram() : counts{}, count{}, sum_us{}, min_us{}, max_us{} {
+    reset();
+  }
+
+  void record(double seconds) {
+    unsigned long long us{
+        static_cast<unsigned long long>(std::max(0.0, seconds) * 1e6)};
+
+    counts[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum_us.fetch_add(us, std::memory_order_relaxed);
+    update_min(us);
+    update_max(us);
+  }
+
+  // Add all the values recorded in `other` to this histogram
+  void merge(const GnuplotLatencyHistogram &other) {
+    for (size_t i{}; i < NUM_BUCKETS; ++i)
+      counts[i].fetch_add(other.counts[i].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+
+    count.fetch_add(other.count.load(), std::memory_order_relaxed);
+    sum_us.fetch_add(other.sum_us.load(), std::memory_order_relaxed);
+    update_min(other.min_us.load());
+    update_max(other.max_us.load());
+  }
+
+  Snapshot snapshot() const {
+    Snapshot result{std::vector<unsigned long long>(NUM_BUCKETS), 0, 0.0, 0.0,
+                    0.0};
+    for (size_t i{}; i < NUM_BUCKETS; ++i) {
+      result.counts[i] = counts[i].load(std::memory_order_relaxed);
+      result.count += result.counts[i];
+    }
+
+    if (result.count > 0) {
+      result.sum_seconds = sum_us.load() * 1e-6;
+      result.min_seconds = min_us.load() * 1e-6;
+      result.max_seconds = max_us.load() * 1e-6;
+    }
+
+    return result;
+  }
+
+  void reset() {
+    for (auto &c : counts)
+      c.store(0);
+
+    count.store(0);
+    sum_us.store(0);
+    min_us.store(~0ULL);
+    max_us.store(0);
+  }
+
+  static size_t bucket_index(unsigned long long us) {
+    if (us < 4)
+      return size_t(us);
+
+    int msb{};
+    while ((us >> (msb + 1)) != 0)
+      ++msb;
+
+    size_t sub{size_t((us >> (msb - 2)) & 3)};
+    return std::min(NUM_BUCKETS - 1, size_t(4 * (msb - 1)) + sub);
+  }
+
+  static double bucket_lower_us(size_t index) {
+    if (index < 4)
+      return double(index);
+
+    int msb{int(index / 4) + 1};
+    return double((4 + index % 4) * (1ULL << (msb - 2)));
+  }
+
+  static double bucket_upper_us(size_t index) {
+    if (index < 4)
+      return double(index);
+
+    int msb{int(index / 4) + 1};
+    return bucket_lower_us(index) + double((1ULL << (msb - 2)) - 1);
+  }
+
+private:
+  void update_min(unsigned long long us) {
+    unsigned long long current{min_us.load(std::memory_order_relaxed)};
+    while (us < current && !min_us.compare_exchange_weak(current, us))
+      ;
+  }
+
+  void update_max(unsigned long long us) {
+    unsigned long long current{max_us.load(std::memory_order_relaxed)};
+    while (us > current && !max_us.compare_exchange_weak(current, us))
+      ;
+  }
+
+  std::atomic<unsigned long long> counts[NUM_BUCKETS];
+  std::atomic<unsigned long long> count;
+  std::atomic<unsigned long long> sum_us;
+  std::atomic<unsigned long long> min_us;
+  std::atomic<unsigned long long> max_us;
+};
+
+/**
+ * Set of latency histograms, one for each category of plot (e.g.,
+ * terminal and number of points). The functions producing reports
+ * (`merge`, `snapshot`, `to_text` and `to_json`) are compiled with
+ * GNUPLOTPP_IMPLEMENTATION (see below).
+ */
+class GnuplotLatencyStats {
+public:
+  GnuplotLatencyStats() : mutex{}, newest{nullptr} {}
+
+  GnuplotLatencyStats(const GnuplotLatencyStats &) = delete;
+  GnuplotLatencyStats &operator=(const GnuplotLatencyStats &) = delete;
+
+  ~GnuplotLatencyStats() {
+    const Entry *cur{newest.load()};
+    while (cur) {
+      const Entry *next{cur->next};
+      delete cur;
+      cur = next;
+    }
+  }
+
+  /* Add a latency to the histogram of `category`. Once the category
+   * exists, this takes no lock: the lookup walks a list that is only
+   * ever prepended to, and the histogram itself is updated atomically */
+  void record(const std::string &category, double seconds) {
+    histogram(category).record(seconds);
+  }
+
+  // Return the histogram of a category, creating it if needed
+  GnuplotLatencyHistogram &histogram(const std::string &category) {
+    const Entry *first{newest.load(std::memory_order_acquire)};
+    const Entry *entry{find(first, nullptr, category)};
+    if (entry)
+      return entry->histogram;
+
+    // Another thread might have created it after `first` was read
+    std::lock_guard<std::mutex> lock{mutex};
+    const Entry *head{newest.load(std::memory_order_relaxed)};
+    entry = find(head, first, category);
+    if (!entry) {
+      entry = new Entry{category, head};
+      newest.store(entry, std::memory_order_release);
+    }
+
+    return entry->histogram;
+  }
+
+  // Add the latencies recorded in `other` to these ones
+  void merge(const GnuplotLatencyStats &other);
+
+  using CategorySnapshot =
+      std::pair<std::string, GnuplotLatencyHistogram::Snapshot>;
+
+  // Copy of the histograms, sorted by category
+  std::vector<CategorySnapshot> snapshot() const;
+
+  // One line per category, with times in milliseconds
+  std::string to_text() const;
+
+  // A JSON object with one key per category, with times in seconds
+  std::string to_json() const;
+
+private:
+  struct Entry {
+    Entry(const std::string &cat, const Entry *nxt)
+        : category{cat}, next{nxt}, histogram{} {}
+
+    const std::string category;
+    const Entry *const next;
+    mutable GnuplotLatencyHistogram histogram;
+  };
+
+  // Look for a category in the list, from `first` up to `last` excluded
+  static const Entry *find(const Entry *first, const Entry *last,
+                           const std::string &category) {
+    for (const Entry *cur{first}; cur != last; cur = cur->next) {
+      if (cur->category == category)
+        return cur;
+    }
+
+    return nullptr;
+  }
+
+  // Taken to create an entry; not needed to read `newest`
+  std::mutex mutex;
+  // Most recently created entry, head of the list of all the entries
+  std::atomic<const Entry *> newest;
+};
+
+/**
+ * Pool of Gnuplot processes running scripts concurrently
+ *
+ * Each worker thread keeps one Gnuplot process already running
+ * ("warm"), so that a script submitted to the pool does not have to
+ * wait for Gnuplot to start. When the script has been processed, the
+ * process is closed and a new one is started for the next script.
+ * Gnuplot processes taking longer than the time set by `set_timeout`
+ * are killed, so that a single bad script cannot stall the pool.
+ *
+ * The pool is compiled with GNUPLOTPP_IMPLEMENTATION (see below), so
+ * that only that file needs the headers of the standard library
+ * dealing with threads.
+ */
+class GnuplotPool {
+private:
+  // Result of a job, shared by the worker and by `Pending`
+  struct JobState;
+
+public:
+  struct Result {
+    // True if Gnuplot exited without errors
+    bool ok;
+    // Time elapsed between the submission and the end of the job
+    double seconds;
+  };
+
+  // Handle to a script submitted to the pool
+  class Pending {
+  public:
+    // Wait until the script has been run, and return its result
+    Result get();
+
+  private:
+    friend class GnuplotPool;
+    explicit Pending(const std::shared_ptr<JobState> &job_state)
+        : state{job_state} {}
+
+    std::shared_ptr<JobState> state;
+  };
+
+  explicit GnuplotPool(size_t num_workers = 0,
+                       const std::string &executable_name = "gnuplot");
+
+  GnuplotPool(const GnuplotPool &) = delete;
+  GnuplotPool &operator=(const GnuplotPool &) = delete;
+
+  // Wait for all the pending scripts to complete
+  ~GnuplotPool();
+
+  /* Run a Gnuplot script in the first available process. The script
+     must contain all the commands needed to produce the plot,
+     including "set terminal" and "set output". */
+  Pending submit(const std::string &script);
+
+  size_t size() const;
+
+  /* Kill Gnuplot if it has not completed a script after `seconds`
+     (if positive), counting from when a worker starts it; the result
+     of the script is then not ok. This applies to the scripts
+     submitted from now on. */
+  void set_timeout(double seconds);
+
+  /* Time spent by Gnuplot to run each script, grouped by the terminal
+     used in the script */
+  GnuplotLatencyStats &latency_stats() { return stats; }
+
+private:
+  // The queue of the jobs and the worker threads
+  struct Impl;
+
+  void worker_loop();
+
+  // Return the name of the last terminal set in a script
+  static std::string terminal_name(const std::string &script);
+
+  std::string executable;
+  GnuplotLatencyStats stats;
+  std::unique_ptr<Impl> impl;
+};
+
 /**
  * High-level interface to the Gnuplot executable
  *
@@ -64,8 +489,28 @@ const unsigned GNUPLOTPP_PATCH_VERSION = (GNUPLOTPP_VERSION & 0xFF);
  */
 class Gnuplot {
 private:
+  // The pool starts and stops its processes like `Gnuplot` does
+  friend class GnuplotPool;
+
   // Create a name for a temporary file and return it
   std::string tmp_file_name() {
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+    // Data sent to a daemon are kept in anonymous memory, which is
+    // passed to the daemon together with the next command using it
+    if (daemon_client) {
+      int fd{memfd_create("gplotpp", MFD_CLOEXEC)};
+      if (fd >= 0) {
+        memfds_to_pass.push_back(fd);
+        return memfd_path(fd);
+      }
+    }
+#endif
+
+    return disk_file_name();
+  }
+
+  // Create a name for a temporary file on disk and return it
+  std::string disk_file_name() {
     // Calling "tmpnam" makes GCC emit a warning, but there is no
     // portable way to create a temporary file name in C++
     std::string filename{std::tmpnam(nullptr)};
@@ -74,6 +519,19 @@ private:
     return filename;
   }
 
+  // Used for strings within double quotes, e.g., tic labels
+  std::string escape_double_quotes(const std::string &s) {
+    std::string result{};
+
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        result.push_back('\\');
+      result.push_back(c);
+    }
+
+    return result;
+  }
+
   std::string escape_quotes(const std::string &s) {
     std::string result{};
 
@@ -95,6 +553,7 @@ public:
     LINESPOINTS,
     STEPS,
     BOXES,
+    IMAGE, // Only used for spectrograms and heatmaps
   };
 
   enum class AxisScale {
@@ -104,82 +563,353 @@ public:
     LOGXY,
   };
 
-  Gnuplot(const char *executable_name = "gnuplot", bool persist = true)
-      : connection{}, series{}, files_to_delete{}, is_3dplot{false} {
-    std::stringstream os;
-    // The --persist flag lets Gnuplot keep running after the C++
-    // program has completed its execution
-    os << executable_name;
-    if (persist)
-      os << " --persist";
-    connection = popen(os.str().c_str(), "w");
+  /* Trade-off between speed and look used by `redirect_to_png`. Run
+     `benchmark-terminals` to measure how fast each terminal is with
+     the Gnuplot installed on your system. */
+  enum class Quality {
+    DRAFT,       // libgd "png" terminal, no antialiasing: fastest
+    NORMAL,      // "pngcairo" terminal, antialiased
+    PUBLICATION, // "pngcairo" with rounded, thicker lines
+    AUTO,        // DRAFT for thumbnail-sized images, NORMAL otherwise
+  };
 
-    set_xrange();
-    set_yrange();
-    set_zrange();
+  // Memory layout of a matrix stored in a flat vector
+  enum class MatrixLayout {
+    ROW_MAJOR,    // Elements of the same row are contiguous
+    COLUMN_MAJOR, // Elements of the same column are contiguous
+  };
 
-    // See
-    // https://stackoverflow.com/questions/28152719/how-to-make-gnuplot-use-the-unicode-minus-sign-for-negative-numbers
-    sendcommand("set encoding utf8\n");
-    sendcommand("set minussign");
-  }
+  /* Handle to a column of a data file shared by several series. Use
+     `share_x` and `share_column` to create them. */
+  struct SharedColumn {
+    size_t table;
+    // Index of the column in the file, starting from 1 as in Gnuplot;
+    // zero if the column could not be added
+    size_t column;
+
+    bool valid() const { return column > 0; }
+  };
+
+  /* Path to the Unix socket of a render daemon (see the program
+     `gplotpp-daemon`) */
+  struct DaemonSocket {
+    std::string path;
+
+    explicit DaemonSocket(
+        const std::string &socket_path = "/tmp/gplotpp.sock")
+        : path{socket_path} {}
+  };
+
+  /* Options for a Gnuplot process that is started only when a plot
+     needs it (see `Renderer::NATIVE`) */
+  struct LazyStart {
+    std::string executable;
+    bool persist;
+
+    explicit LazyStart(const std::string &executable_name = "gnuplot",
+                       bool persist_window = true)
+        : executable{executable_name}, persist{persist_window} {}
+  };
+
+  // Who draws the plots saved by `redirect_to_svg` and `redirect_to_png`
+  enum class Renderer {
+    GNUPLOT, // Always Gnuplot
+    NATIVE,  // gplot++ itself, if it supports everything in the plot
+  };
+
+  /* Features of a Gnuplot executable, as reported by the variables
+     GPVAL_VERSION, GPVAL_PATCHLEVEL, GPVAL_TERMINALS and
+     GPVAL_COMPILE_OPTIONS. If the executable could not be queried,
+     `probed` is false and the most conservative choices are made. */
+  struct Capabilities {
+    bool probed = false;
+    int major = 0, minor = 0;
+    std::string patchlevel;
+    std::vector<std::string> terminals;
+    std::string compile_options;
 
-  ~Gnuplot() {
-    // Bye bye, Gnuplot!
-    if (connection) {
-      pclose(connection);
-      connection = nullptr;
+    bool has_terminal(const std::string &name) const {
+      return std::find(terminals.begin(), terminals.end(), name) !=
+             terminals.end();
     }
 
-    // Let some time pass before removing the files, so that Gnuplot
-    // can finish displaying the last plot.
-    sleep(1);
+    bool at_least(int req_major, int req_minor) const {
+      return major > req_major || (major == req_major && minor >= req_minor);
+    }
+
+    // Can Gnuplot read files of doubles with "binary format='%float64'"?
+    bool supports_binary_data() const { return probed && at_least(5, 0); }
+  };
+
+  // How the data of the series are passed to Gnuplot
+  enum class DataTransport {
+    TEXT,   // Numbers are written as text: works with every Gnuplot
+    BINARY, // Numbers are written as raw doubles: much faster
+  };
+
+  /* Ask Gnuplot about its version and its features. The answer is
+     cached, so each executable is only run once per program. Gnuplot
+     is given 5 seconds to answer, after which it is killed and nothing
+     is known about it. */
+  static Capabilities probe_capabilities(const std::string &executable) {
+    static std::mutex mutex;
+    // Programs use one or two executables, so a vector is enough
+    static std::vector<std::pair<std::string, Capabilities>> cache;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    for (const auto &entry : cache) {
+      if (entry.first == executable)
+        return entry.second;
+    }
+
+    Capabilities caps{};
+
+#ifdef _WIN32
+    std::string script{std::tmpnam(nullptr)};
+#else
+    // The script is created atomically, so that no other process can
+    // take its name in the meantime
+    char script_template[] = "/tmp/gplotpp-probe-XXXXXX";
+    int script_fd{mkstemp(script_template)};
+    if (script_fd < 0)
+      return caps;
+    close(script_fd);
+    std::string script{script_template};
+#endif
+    {
+      // Gnuplot stops at the first undefined variable, so the oldest
+      // ones come first
+      std::ofstream of{script};
+      of << "set terminal unknown\n"
+         << "set print '-'\n"
+         << "print GPVAL_VERSION\n"
+         << "print GPVAL_PATCHLEVEL\n"
+         << "print GPVAL_TERMINALS\n"
+         << "print GPVAL_COMPILE_OPTIONS\n";
+    }
+
+#ifdef _WIN32
+    const std::string null_device{"NUL"};
+#else
+    const std::string null_device{"/dev/null"};
+#endif
+    const std::string command{executable + " \"" + script + "\" < " +
+                              null_device + " 2> " + null_device};
+    std::string text;
+    if (read_command_output(command, 5.0, text)) {
+      std::istringstream is{text};
+      std::string line;
+      if (std::getline(is, line) &&
+          std::sscanf(line.c_str(), "%d.%d", &caps.major, &caps.minor) == 2) {
+        caps.probed = true;
+        std::getline(is, caps.patchlevel);
+
+        if (std::getline(is, line)) {
+          std::istringstream names{line};
+          std::string name;
+          while (names >> name)
+            caps.terminals.push_back(name);
+        }
 
-    // Now remove the data files
-    for (const auto &fname : files_to_delete) {
-      std::remove(fname.c_str());
+        caps.compile_options.assign(std::istreambuf_iterator<char>{is},
+                                    std::istreambuf_iterator<char>{});
+      }
     }
+    std::remove(script.c_str());
+
+    cache.emplace_back(executable, caps);
+    return caps;
   }
 
-  /* This is the most low-level method in the Gnuplot class! It
-         returns `true` if the send command was successful, `false`
-         otherwise. */
-  bool sendcommand(const char *str) {
-    if (!ok())
+  /* Run a shell command and save what it writes in `text`. Return
+     `false` if the command could not be run or, where possible, if it
+     did not terminate within `timeout` seconds; in this case it is
+     killed. */
+  static bool read_command_output(const std::string &command, double timeout,
+                                  std::string &text) {
+    char buffer[4096];
+#ifdef _WIN32
+    FILE *output{popen(command.c_str(), "r")};
+    if (!output)
       return false;
 
-    fputs(str, connection);
-    fputc('\n', connection);
-    fflush(connection);
-
+    size_t nbytes;
+    while ((nbytes = fread(buffer, 1, sizeof(buffer), output)) > 0)
+      text.append(buffer, nbytes);
+    pclose(output);
     return true;
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+      return false;
+
+    const std::string shell_command{"exec " + command};
+    pid_t pid{fork()};
+    if (pid == 0) {
+      dup2(fds[1], STDOUT_FILENO);
+      close(fds[0]);
+      close(fds[1]);
+      execl("/bin/sh", "sh", "-c", shell_command.c_str(), (char *)nullptr);
+      _exit(127);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+      close(fds[0]);
+      return false;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration<double>(timeout);
+    bool completed{false};
+    while (true) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0)
+        break;
+
+      pollfd pfd{fds[0], POLLIN, 0};
+      int result{poll(&pfd, 1, int(left.count()))};
+      if (result < 0 && errno != EINTR)
+        break;
+      if (result <= 0)
+        continue;
+
+      ssize_t nbytes{read(fds[0], buffer, sizeof(buffer))};
+      if (nbytes > 0) {
+        text.append(buffer, nbytes);
+      } else if (nbytes == 0) {
+        completed = true;
+        break;
+      } else if (errno != EINTR) {
+        break;
+      }
+    }
+    close(fds[0]);
+
+    if (!completed)
+      kill(pid, SIGKILL);
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+      ;
+    return completed;
+#endif
   }
 
+  Gnuplot(const char *executable_name = "gnuplot", bool persist = true);
+
+  /* Instead of starting a new Gnuplot process, send commands to one
+     of the Gnuplot processes kept ready by a render daemon. Data are
+     passed to the daemon through shared memory instead of temporary
+     files. The plots are rendered once this object is destroyed, so
+     you should save them in files using `redirect_to_png` or
+     `redirect_to_pdf`. */
+  explicit Gnuplot(const DaemonSocket &daemon);
+
+  /* Do not start Gnuplot until a command must be executed: commands
+     are kept in memory, and plots that can be drawn by `Renderer::NATIVE`
+     never start it at all. Once started, Gnuplot receives the commands
+     sent so far and draws every following plot. */
+  explicit Gnuplot(const LazyStart &lazy);
+
+  ~Gnuplot();
+
+  /* This is the most low-level method in the Gnuplot class! It
+         returns `true` if the send command was successful, `false`
+         otherwise. */
+  bool sendcommand(const char *str);
+
   bool sendcommand(const std::string &str) { return sendcommand(str.c_str()); }
   bool sendcommand(const std::stringstream &stream) {
     return sendcommand(stream.str());
   }
 
-  bool ok() { return connection != nullptr; }
+  bool ok() { return connection != nullptr || lazy_start; }
 
   /* Save the plot to a PNG file instead of displaying a window */
   bool redirect_to_png(const std::string &filename,
-                       const std::string &size = "800,600") {
-    std::stringstream os;
+                       const std::string &size = "800,600",
+                       Quality quality = Quality::NORMAL) {
+    native_renderer = nullptr;
+    if (quality == Quality::AUTO)
+      quality = is_thumbnail_size(size) ? Quality::DRAFT : Quality::NORMAL;
+
+    switch (quality) {
+    case Quality::DRAFT:
+      png_terminal = available_terminal("png", "pngcairo");
+      break;
+    case Quality::PUBLICATION:
+      png_terminal = available_terminal(
+          "pngcairo color enhanced rounded linewidth 1.5", "png");
+      break;
+    default:
+      png_terminal = available_terminal("pngcairo color enhanced", "png");
+    }
+    png_size = size;
+    current_terminal = png_terminal.substr(0, png_terminal.find(' '));
 
-    os << "set terminal pngcairo color enhanced size " << size << "\n"
+    std::stringstream os;
+    os << "set terminal " << png_terminal << " size " << size << "\n"
        << "set output '" << filename << "'\n";
-    return sendcommand(os);
+    return send_terminal_commands(os.str());
+  }
+
+  /* Save a small preview of the plot to a PNG file. This is the
+     fastest path: it uses the libgd terminal with a tiny font and
+     removes the key, the tics and the margins, which would take most
+     of the space in such a small image anyway. With `Renderer::NATIVE`
+     and a Gnuplot object created with `LazyStart`, lines, steps and
+     boxes are drawn directly by gplot++, in the same way. */
+  bool redirect_to_thumbnail(const std::string &filename,
+                             const std::string &size = "160,120",
+                             Renderer r = Renderer::GNUPLOT) {
+    use_renderer(r);
+    native_output = filename;
+    native_size = size;
+    png_terminal = available_terminal("png tiny", "pngcairo font ',6'");
+    png_size = size;
+    current_terminal = png_terminal.substr(0, png_terminal.find(' '));
+
+    std::stringstream os;
+    os << "set terminal " << png_terminal << " size " << size << "\n"
+       << "set output '" << filename << "'\n"
+       << "unset key\n"
+       << "unset tics\n"
+       << "set margins 0, 0, 0, 0\n";
+    return send_terminal_commands(os.str());
   }
 
   /* Save the plot to a PDF file instead of displaying a window */
   bool redirect_to_pdf(const std::string &filename,
                        std::string size = "16cm,12cm") {
+    native_renderer = nullptr;
+    std::string terminal{
+        available_terminal("pdfcairo color enhanced", "pdf color enhanced")};
+    current_terminal = terminal.substr(0, terminal.find(' '));
+
     std::stringstream os;
+    os << "set terminal " << terminal << " size " << size << "\n"
+       << "set output '" << filename << "'\n";
+    return send_terminal_commands(os.str());
+  }
 
-    os << "set terminal pdfcairo color enhanced size " << size << "\n"
+  /* Save the plot to a SVG file instead of displaying a window. With
+     `Renderer::NATIVE` and a Gnuplot object created with `LazyStart`,
+     2D plots of lines and points are written directly by gplot++,
+     with a few points per pixel at most. Plots using anything else
+     (e.g., other styles, log scales, or commands passed to
+     `sendcommand`) are drawn by Gnuplot, which is started if needed. */
+  bool redirect_to_svg(const std::string &filename,
+                       const std::string &size = "800,600",
+                       Renderer r = Renderer::GNUPLOT) {
+    use_renderer(r);
+    native_output = filename;
+    native_size = size;
+    current_terminal = "svg";
+
+    std::stringstream os;
+    os << "set terminal svg size " << size << "\n"
        << "set output '" << filename << "'\n";
-    return sendcommand(os);
+    return send_terminal_commands(os.str());
   }
 
   /* Set the label on the X axis */
@@ -226,107 +956,845 @@ public:
 
   template <typename T>
   void plot(const std::vector<T> &y, const std::string &label = "",
-            LineStyle style = LineStyle::LINES) {
-    if (y.empty())
-      return;
+            LineStyle style = LineStyle::LINES);
 
-    if (!series.empty()) {
-      assert(!is_3dplot);
-    }
+  template <typename T, typename U>
+  void plot(const std::vector<T> &x, const std::vector<U> &y,
+            const std::string &label = "", LineStyle style = LineStyle::LINES);
 
-    std::string filename{tmp_file_name()};
-    std::ofstream of{filename};
-    assert(of.good());
-    for (const auto &val : y) {
-      of << val << "\n";
-    }
+  /* Store a vector of x values that will be shared by several series.
+     Each shared column is written only once, in a single data file
+     with one column per vector, the first time a plot using it is
+     shown. Add all the columns with `share_column` before the first
+     call to `show`, or the file will have to be written again. The
+     vectors are not copied, so they must not change or be destroyed
+     until the plots using them have been shown; temporaries are
+     rejected at compile time. */
+  template <typename T> SharedColumn share_x(const std::vector<T> &x) {
+    shared_tables.push_back(SharedTable{{}, x.size(), "", 0});
+    shared_tables.back().columns.push_back(column_writer(x));
 
-    series.push_back(GnuplotSeries{filename, style, label, "0:1"});
-    is_3dplot = false;
+    return SharedColumn{shared_tables.size() - 1, 1};
   }
 
-  template <typename T, typename U>
-  void plot(const std::vector<T> &x, const std::vector<U> &y,
-            const std::string &label = "", LineStyle style = LineStyle::LINES) {
-    assert(x.size() == y.size());
+  template <typename T> SharedColumn share_x(const std::vector<T> &&) = delete;
 
-    if (x.empty())
-      return;
+  /* Add a vector of y values to the data file containing `x`, which
+     must have been created by `share_x`. If `x` is not valid or `y`
+     does not have as many elements as `x`, nothing is added and the
+     column returned is not valid. */
+  template <typename U>
+  SharedColumn share_column(const SharedColumn &x, const std::vector<U> &y) {
+    if (!x.valid() || x.table >= shared_tables.size() ||
+        shared_tables[x.table].nrows != y.size())
+      return SharedColumn{x.table, 0};
 
-    if (!series.empty()) {
+    SharedTable &table = shared_tables[x.table];
+    table.columns.push_back(column_writer(y));
+
+    return SharedColumn{x.table, table.columns.size()};
+  }
+
+  template <typename U>
+  SharedColumn share_column(const SharedColumn &,
+                            const std::vector<U> &&) = delete;
+
+  /* Plot two columns created by `share_x` and `share_column`. They
+     must belong to the same data file. Columns that are not valid are
+     not plotted. */
+  void plot(const SharedColumn &x, const SharedColumn &y,
+            const std::string &label = "", LineStyle style = LineStyle::LINES) {
+    assert(x.table == y.table);
+
+    if (!x.valid() || !y.valid() || x.table != y.table ||
+        x.table >= shared_tables.size() || shared_tables[x.table].nrows == 0)
+      return;
+
+    if (!series.empty()) {
+      assert(!is_3dplot);
+    }
+
+    std::stringstream columns;
+    columns << x.column << ":" << y.column;
+
+    GnuplotSeries s{"", style, label, columns.str(),
+                    shared_tables[x.table].nrows};
+    s.shared_table = x.table;
+    series.push_back(s);
+    is_3dplot = false;
+  }
+
+  /* Plot the columns of a matrix with `nrows` rows against its first
+     column (e.g., a time stream followed by many channels). The
+     matrix is written once in one data file, and one series per
+     column is created; `names` contains the titles of the series, so
+     it must have one element less than the number of columns. */
+  template <typename T>
+  void plot_columns(const std::vector<T> &matrix, size_t nrows,
+                    const std::vector<std::string> &names,
+                    MatrixLayout layout = MatrixLayout::ROW_MAJOR,
+                    LineStyle style = LineStyle::LINES) {
+    GNUPLOTPP_TRACE_SPAN("plot", "columns");
+
+    if (matrix.empty() || nrows == 0)
+      return;
+
+    const size_t ncols{matrix.size() / nrows};
+    assert(ncols * nrows == matrix.size());
+    assert(names.size() + 1 == ncols);
+
+    if (!series.empty()) {
       assert(!is_3dplot);
     }
 
+    GNUPLOTPP_TRACE_SPAN("write", "columns");
     std::string filename{tmp_file_name()};
     std::ofstream of{filename};
     assert(of.good());
-    for (size_t i{}; i < x.size(); ++i) {
-      of << x[i] << " " << y[i] << "\n";
+
+    if (layout == MatrixLayout::ROW_MAJOR) {
+      write_rows(of, matrix.data(), nrows, ncols);
+    } else {
+      // Transpose a few rows at a time, so that the buffer stays small
+      const size_t rows_per_chunk{std::max<size_t>(1, 65536 / ncols)};
+      std::vector<T> chunk(rows_per_chunk * ncols);
+      for (size_t first{}; first < nrows; first += rows_per_chunk) {
+        size_t count{std::min(rows_per_chunk, nrows - first)};
+        transpose_block(matrix.data(), nrows, ncols, first, count,
+                        chunk.data());
+        write_rows(of, chunk.data(), count, ncols);
+      }
     }
 
-    series.push_back(GnuplotSeries{filename, style, label, "1:2"});
+    for (size_t col{1}; col < ncols; ++col) {
+      std::stringstream columns;
+      columns << "1:" << col + 1;
+      series.push_back(GnuplotSeries{filename, style, names[col - 1],
+                                     columns.str(), nrows});
+    }
     is_3dplot = false;
   }
 
   template <typename T, typename U>
   void plot3d(const std::vector<T> &x, const std::vector<U> &y,
               const std::vector<U> &z, const std::string &label = "",
-              LineStyle style = LineStyle::LINES) {
+              LineStyle style = LineStyle::LINES);
+
+  // What `histogram` shows for each bin
+  enum class HistogramNorm {
+    COUNT,       // Number of values in the bin
+    DENSITY,     // Fraction of values in the bin, divided by its width
+    PROBABILITY, // Fraction of values in the bin
+    CUMULATIVE,  // Fraction of values in the bin and in the previous ones
+  };
+
+  /* Plot the histogram of the values using `nbins` bins of the same
+     width, spanning the range of the values. The bins can be read
+     afterwards with `last_histogram`. */
+  template <typename T>
+  void histogram(const std::vector<T> &values, size_t nbins,
+                 const std::string &label = "",
+                 LineStyle style = LineStyle::BOXES,
+                 HistogramNorm norm = HistogramNorm::COUNT);
+
+  struct HistogramBins {
+    // Bin i contains the values in [edges[i], edges[i + 1]); the last
+    // one includes its right edge as well
+    std::vector<double> edges;
+    std::vector<size_t> counts;
+    // What was plotted for each bin, according to the HistogramNorm
+    std::vector<double> values;
+  };
+
+  /* Return the bins computed by the last call to `histogram` */
+  const HistogramBins &last_histogram() const { return histogram_bins; }
+
+  /* Fit a polynomial of the given degree to the points using least
+     squares, and add the fitted curve as a new series, sampled once per
+     pixel of the output. Return the coefficients c₀, c₁, …, so that
+     y = c₀ + c₁ x + c₂ x² + …, or an empty vector if the fit is not
+     possible (e.g., there are too few points). */
+  template <typename T, typename U>
+  std::vector<double> fit_poly(const std::vector<T> &x,
+                               const std::vector<U> &y, int degree,
+                               const std::string &label = "",
+                               LineStyle style = LineStyle::LINES) {
+    GNUPLOTPP_TRACE_SPAN("fit", label);
+
     assert(x.size() == y.size());
-    assert(x.size() == z.size());
+    assert(degree >= 0);
+
+    const size_t nterms{size_t(degree) + 1};
+    if (x.size() < nterms)
+      return {};
+
+    // The sums are computed with respect to the first point, so that
+    // large offsets (e.g., timestamps) do not spoil the precision
+    const double shift{double(x.front())};
+    const size_t nchunks{num_chunks(x.size())};
+    std::vector<PowerSums> partial(nchunks, PowerSums(degree));
+    parallel_chunks(x.size(), nchunks, [&](size_t c, size_t begin, size_t end) {
+      partial[c].add(x.data() + begin, y.data() + begin, end - begin, shift);
+    });
+    for (size_t c{1}; c < nchunks; ++c)
+      partial[0].merge(partial[c]);
+    const PowerSums &sums{partial[0]};
+
+    // Solve the normal equations A·a = b, where A[i][j] = Σ uⁱ⁺ʲ and
+    // b[i] = Σ uⁱ y, after scaling them so that A has a unit diagonal
+    std::vector<double> a(nterms * nterms), b(nterms), scale(nterms);
+    for (size_t i{}; i < nterms; ++i)
+      scale[i] = sums.x[2 * i] > 0 ? 1.0 / std::sqrt(sums.x[2 * i]) : 0.0;
+    for (size_t i{}; i < nterms; ++i) {
+      for (size_t j{}; j < nterms; ++j)
+        a[i * nterms + j] = sums.x[i + j] * scale[i] * scale[j];
+      b[i] = sums.xy[i] * scale[i];
+    }
+
+    if (!solve_linear_system(a, b))
+      return {};
+
+    std::vector<double> shifted(nterms);
+    for (size_t i{}; i < nterms; ++i)
+      shifted[i] = b[i] * scale[i];
+
+    const size_t nsamples{display_samples()};
+    std::vector<double> fit_x(nsamples), fit_y(nsamples);
+    for (size_t i{}; i < nsamples; ++i) {
+      fit_x[i] = sums.min + (sums.max - sums.min) * i / (nsamples - 1);
+
+      const double u{fit_x[i] - shift};
+      double value{};
+      for (size_t k{nterms}; k-- > 0;)
+        value = value * u + shifted[k];
+      fit_y[i] = value;
+    }
+    plot_points(fit_x, fit_y, label, style);
+
+    // Expand c(x - shift) into powers of x: the coefficient of xʲ
+    // gets a contribution binom(k, j) (-shift)ᵏ⁻ʲ from each term k ≥ j
+    std::vector<double> coefficients(nterms);
+    for (size_t k{}; k < nterms; ++k) {
+      double binom{1.0};
+      for (size_t j{k + 1}; j-- > 0;) {
+        coefficients[j] += shifted[k] * binom * std::pow(-shift, k - j);
+        binom = binom * j / (k - j + 1);
+      }
+    }
+
+    return coefficients;
+  }
+
+  /* Fit a straight line to the points, add it as a new series and
+     return its intercept and slope */
+  template <typename T, typename U>
+  std::vector<double> fit_line(const std::vector<T> &x,
+                               const std::vector<U> &y,
+                               const std::string &label = "",
+                               LineStyle style = LineStyle::LINES) {
+    return fit_poly(x, y, 1, label, style);
+  }
+
+  /* Filter applied to the y values of the series added by `plot` while
+     they are written to the data file, so that no smoothed copy of the
+     data is kept in memory. Create them with the static functions. */
+  struct Smoothing {
+    enum class Kind {
+      NONE,
+      MOVING_AVERAGE,   // Mean of a window centered on each point
+      TRAILING_AVERAGE, // Mean of the point and of the previous ones
+      EXPONENTIAL,      // s = α y + (1 - α) s
+      MEDIAN,           // Median of a window centered on each point
+      SAVITZKY_GOLAY,   // Polynomial fit of a window centered on each point
+    };
+
+    Kind kind;
+    size_t window;
+    double alpha;
+    int order;
+
+    Smoothing(Kind k = Kind::NONE, size_t w = 1, double a = 1.0, int o = 0)
+        : kind{k}, window{w}, alpha{a}, order{o} {}
+
+    static Smoothing none() { return Smoothing{}; }
+    static Smoothing moving_average(size_t window) {
+      return Smoothing{Kind::MOVING_AVERAGE, window, 1.0, 0};
+    }
+    static Smoothing trailing_average(size_t window) {
+      return Smoothing{Kind::TRAILING_AVERAGE, window, 1.0, 0};
+    }
+    static Smoothing exponential(double alpha) {
+      return Smoothing{Kind::EXPONENTIAL, 1, alpha, 0};
+    }
+    static Smoothing median(size_t window) {
+      return Smoothing{Kind::MEDIAN, window, 1.0, 0};
+    }
+    static Smoothing savitzky_golay(size_t window, int order) {
+      return Smoothing{Kind::SAVITZKY_GOLAY, window, 1.0, order};
+    }
+  };
+
+  /* Smooth the y values of the series added by `plot` from now on, up
+     to the next call to `show`. Centered windows must have an odd
+     number of points, and are shortened near the ends of the data. Use
+     `Smoothing::none()` to stop smoothing. */
+  void set_smoothing(const Smoothing &filter) {
+    assert(filter.window > 0);
+    if (filter.kind == Smoothing::Kind::MOVING_AVERAGE ||
+        filter.kind == Smoothing::Kind::MEDIAN ||
+        filter.kind == Smoothing::Kind::SAVITZKY_GOLAY) {
+      assert(filter.window % 2 == 1);
+    }
+    assert(filter.kind != Smoothing::Kind::SAVITZKY_GOLAY ||
+           (filter.order >= 0 && size_t(filter.order) < filter.window));
+    assert(filter.kind != Smoothing::Kind::EXPONENTIAL ||
+           (filter.alpha > 0 && filter.alpha <= 1));
+
+    smoothing = filter;
+    smoothing_start = &SmoothingFilter::start;
+  }
+
+  /* Plot the spectrogram of a signal sampled at `fs` Hz: the signal
+     is split in frames of `window` samples (a power of two), each
+     starting `hop` samples after the previous one, and the amplitude
+     of the Fourier transform of each frame (with a Hann window) is
+     shown in decibels as a function of time (in seconds) and
+     frequency (in Hz). Frames are processed in parallel, and the
+     matrix is passed to Gnuplot as a binary image. */
+  template <typename T>
+  void spectrogram(const std::vector<T> &signal, double fs, size_t window,
+                   size_t hop, const std::string &label = "") {
+    GNUPLOTPP_TRACE_SPAN("plot", label);
+
+    assert(fs > 0);
+    assert(window >= 2 && (window & (window - 1)) == 0);
+    assert(hop > 0);
+
+    if (signal.size() < window)
+      return;
+
+    if (!series.empty()) {
+      assert(!is_3dplot);
+    }
+
+    const size_t nframes{(signal.size() - window) / hop + 1};
+    const size_t nfreqs{window / 2 + 1};
+    const FourierTransform fft{window};
+
+    // M_PI is not part of standard C++
+    const double pi{std::acos(-1.0)};
+    std::vector<double> taper(window);
+    for (size_t i{}; i < window; ++i)
+      taper[i] = 0.5 - 0.5 * std::cos(2 * pi * i / window);
+
+    // Row-major image with one row per frequency, as in Gnuplot's
+    // "binary array=(nframes,nfreqs)"
+    std::vector<float> image(nframes * nfreqs);
+    parallel_chunks(
+        nframes, num_chunks(nframes * window),
+        [&](size_t, size_t begin, size_t end) {
+          std::vector<double> re(window), im(window);
+          for (size_t frame{begin}; frame < end; ++frame) {
+            const T *samples{signal.data() + frame * hop};
+            for (size_t i{}; i < window; ++i) {
+              re[i] = double(samples[i]) * taper[i];
+              im[i] = 0.0;
+            }
+
+            fft.transform(re, im);
+            for (size_t f{}; f < nfreqs; ++f) {
+              const double amplitude{std::hypot(re[f], im[f]) / window};
+              image[f * nframes + frame] =
+                  float(20 * std::log10(amplitude + 1e-300));
+            }
+          }
+        });
+
+    GNUPLOTPP_TRACE_SPAN("write", label);
+    std::string filename{tmp_file_name()};
+    {
+      std::ofstream of{filename, std::ios::binary};
+      assert(of.good());
+      of.write(reinterpret_cast<const char *>(image.data()),
+               image.size() * sizeof(float));
+    }
+
+    // Each pixel is centered on the middle of its frame
+    std::stringstream format;
+    format << "binary array=(" << nframes << "," << nfreqs
+           << ") format='%float32' origin=(" << 0.5 * window / fs
+           << ",0) dx=" << hop / fs << " dy=" << fs / window;
+
+    series.push_back(
+        GnuplotSeries{filename, LineStyle::IMAGE, label, "1", image.size()});
+    series.back().binary_format = format.str();
+    is_3dplot = false;
+  }
+
+  /* Plot the Pearson correlation coefficient of each pair of channels
+     as a heatmap. `matrix` contains `nsamples` samples of each channel,
+     stored as in `plot_columns`, and `names` (if not empty) the names
+     of the channels, used as tic labels. The coefficients are returned
+     as a row-major square matrix. */
+  template <typename T>
+  std::vector<double>
+  correlation_heatmap(const std::vector<T> &matrix, size_t nsamples,
+                      const std::vector<std::string> &names = {},
+                      MatrixLayout layout = MatrixLayout::ROW_MAJOR) {
+    GNUPLOTPP_TRACE_SPAN("plot", "correlation");
+
+    if (matrix.empty() || nsamples == 0)
+      return {};
+
+    const size_t nchannels{matrix.size() / nsamples};
+    assert(nchannels * nsamples == matrix.size());
+    assert(names.empty() || names.size() == nchannels);
+
+    if (!series.empty()) {
+      assert(!is_3dplot);
+    }
+
+    // Element (sample, channel) of the matrix
+    const size_t sample_stride{layout == MatrixLayout::ROW_MAJOR ? nchannels
+                                                                 : 1};
+    const size_t channel_stride{layout == MatrixLayout::ROW_MAJOR ? 1
+                                                                  : nsamples};
+
+    const size_t nchunks{std::min(num_chunks(matrix.size()),
+                                  std::max<size_t>(1, nsamples / 128))};
+
+    // First pass: the mean of each channel
+    std::vector<std::vector<double>> sums(nchunks);
+    parallel_chunks(nsamples, nchunks, [&](size_t c, size_t begin, size_t end) {
+      sums[c].assign(nchannels, 0.0);
+      for (size_t sample{begin}; sample < end; ++sample) {
+        const T *row{matrix.data() + sample * sample_stride};
+        for (size_t ch{}; ch < nchannels; ++ch)
+          sums[c][ch] += double(row[ch * channel_stride]);
+      }
+    });
+    std::vector<double> mean(nchannels);
+    for (size_t c{}; c < nchunks; ++c) {
+      for (size_t ch{}; ch < nchannels; ++ch)
+        mean[ch] += sums[c][ch] / nsamples;
+    }
+
+    // Second pass: the covariance matrix, with each thread summing the
+    // products of its samples in its own matrix
+    std::vector<std::vector<double>> partial(nchunks);
+    parallel_chunks(nsamples, nchunks, [&](size_t c, size_t begin, size_t end) {
+      partial[c].assign(nchannels * nchannels, 0.0);
+      accumulate_covariance(matrix.data(), sample_stride, channel_stride,
+                            mean, begin, end, partial[c].data());
+    });
+    std::vector<double> &cov{partial[0]};
+    for (size_t c{1}; c < nchunks; ++c) {
+      for (size_t i{}; i < cov.size(); ++i)
+        cov[i] += partial[c][i];
+    }
+
+    // Only the upper triangle has been computed. A constant channel is
+    // not correlated with any other, including itself.
+    std::vector<double> correlation(nchannels * nchannels);
+    for (size_t i{}; i < nchannels; ++i) {
+      for (size_t j{i}; j < nchannels; ++j) {
+        const double norm{
+            std::sqrt(cov[i * nchannels + i] * cov[j * nchannels + j])};
+        const double value{norm > 0 ? cov[i * nchannels + j] / norm : 0.0};
+        correlation[i * nchannels + j] = correlation[j * nchannels + i] = value;
+      }
+    }
+
+    GNUPLOTPP_TRACE_SPAN("write", "correlation");
+    std::vector<float> image(correlation.begin(), correlation.end());
+    std::string filename{tmp_file_name()};
+    {
+      std::ofstream of{filename, std::ios::binary};
+      assert(of.good());
+      of.write(reinterpret_cast<const char *>(image.data()),
+               image.size() * sizeof(float));
+    }
+
+    // These settings only apply to this plot
+    std::stringstream os;
+    os << "set cbrange [-1:1]\n";
+    plot_cleanup += "set cbrange [*:*]\n";
+    if (!names.empty()) {
+      for (const char *axis : {"x", "y"}) {
+        os << "set " << axis << "tics (";
+        for (size_t ch{}; ch < nchannels; ++ch) {
+          os << (ch > 0 ? ", " : "") << "\"" << escape_double_quotes(names[ch])
+             << "\" " << ch;
+        }
+        os << ")\n";
+        plot_cleanup += std::string{"set "} + axis + "tics autofreq\n";
+      }
+    }
+    plot_settings += os.str();
+
+    std::stringstream format;
+    format << "binary array=(" << nchannels << "," << nchannels
+           << ") format='%float32'";
+    series.push_back(GnuplotSeries{filename, LineStyle::IMAGE, "", "1",
+                                   image.size()});
+    series.back().binary_format = format.str();
+    is_3dplot = false;
+
+    return correlation;
+  }
+
+  // How `histograms` draws the boxes of different groups
+  enum class HistogramLayout {
+    CLUSTERED, // Side by side within each bin
+    STACKED,   // One on top of the other
+  };
+
+  /* Plot the histograms of several groups of values using the same
+     bins, which span the range of all the values. The minimum and the
+     maximum are found in one pass over all the groups, then the
+     values are binned in parallel and the counts of all the groups
+     are written in one data file. `labels` contains the title of each
+     group. */
+  template <typename T>
+  void histograms(const std::vector<std::vector<T>> &groups, size_t nbins,
+                  const std::vector<std::string> &labels,
+                  HistogramLayout layout = HistogramLayout::CLUSTERED) {
+    GNUPLOTPP_TRACE_SPAN("plot", "histograms");
+
+    assert(nbins > 0);
+    assert(labels.size() == groups.size());
+
+    // The groups are processed as one array, split among the threads
+    const size_t ngroups{groups.size()};
+    std::vector<size_t> starts(ngroups + 1);
+    for (size_t k{}; k < ngroups; ++k)
+      starts[k + 1] = starts[k] + groups[k].size();
 
-    if (x.empty())
+    const size_t total{starts.back()};
+    if (total == 0)
       return;
 
     if (!series.empty()) {
-      assert(is_3dplot);
+      assert(!is_3dplot);
+    }
+
+    const size_t nchunks{num_chunks(total)};
+    std::vector<double> min(nchunks, INFINITY), max(nchunks, -INFINITY);
+    parallel_chunks(total, nchunks, [&](size_t c, size_t begin, size_t end) {
+      auto update = [&](size_t, double value) {
+        min[c] = std::min(min[c], value);
+        max[c] = std::max(max[c], value);
+      };
+      for_each_grouped_value(groups, starts, begin, end, update);
+    });
+
+    const double lowest{*std::min_element(min.begin(), min.end())};
+    const double highest{*std::max_element(max.begin(), max.end())};
+    const double binwidth{highest > lowest ? (highest - lowest) / nbins : 1.0};
+
+    // counts[c][k * nbins + bin] is the number of values of group k in
+    // the bin, as found by thread c
+    std::vector<std::vector<size_t>> counts(nchunks);
+    parallel_chunks(total, nchunks, [&](size_t c, size_t begin, size_t end) {
+      counts[c].assign(ngroups * nbins, 0);
+      auto count = [&](size_t k, double value) {
+        const size_t bin{size_t((value - lowest) / binwidth)};
+        ++counts[c][k * nbins + std::min(nbins - 1, bin)];
+      };
+      for_each_grouped_value(groups, starts, begin, end, count);
+    });
+    for (size_t c{1}; c < nchunks; ++c) {
+      for (size_t i{}; i < counts[0].size(); ++i)
+        counts[0][i] += counts[c][i];
     }
 
+    // One line per bin, with one column per group; stacked groups
+    // contain the sum of the counts of the groups below them
+    GNUPLOTPP_TRACE_SPAN("write", "histograms");
     std::string filename{tmp_file_name()};
     std::ofstream of{filename};
     assert(of.good());
-    for (size_t i{}; i < x.size(); ++i) {
-      of << x[i] << " " << y[i] << " " << z[i] << "\n";
+    for (size_t bin{}; bin < nbins; ++bin) {
+      of << lowest + binwidth * (bin + 0.5);
+      size_t sum{};
+      for (size_t k{}; k < ngroups; ++k) {
+        const size_t count{counts[0][k * nbins + bin]};
+        sum = (layout == HistogramLayout::STACKED) ? sum + count : count;
+        of << " " << sum;
+      }
+      of << "\n";
+    }
+
+    if (layout == HistogramLayout::STACKED) {
+      // Taller boxes are drawn first, so that the others cover them
+      for (size_t k{ngroups}; k-- > 0;) {
+        std::stringstream columns;
+        columns << "1:" << k + 2 << ":(" << binwidth << ")";
+        series.push_back(GnuplotSeries{filename, LineStyle::BOXES, labels[k],
+                                       columns.str(), nbins});
+      }
+    } else {
+      const double width{0.8 * binwidth / ngroups};
+      for (size_t k{}; k < ngroups; ++k) {
+        std::stringstream columns;
+        columns << "($1" << std::showpos << (k + 0.5) * width - 0.4 * binwidth
+                << std::noshowpos << "):" << k + 2 << ":(" << width << ")";
+        series.push_back(GnuplotSeries{filename, LineStyle::BOXES, labels[k],
+                                       columns.str(), nbins});
+      }
     }
+    is_3dplot = false;
+  }
 
-    series.push_back(GnuplotSeries{filename, style, label, "1:2:3"});
-    is_3dplot = true;
+  /* Call `func(k, value)` for the elements from `begin` to `end` of
+     the concatenation of the groups, where `starts[k]` is the index of
+     the first element of group `k` */
+  template <typename T, typename F>
+  static void for_each_grouped_value(const std::vector<std::vector<T>> &groups,
+                                     const std::vector<size_t> &starts,
+                                     size_t begin, size_t end, F func) {
+    size_t k{size_t(std::upper_bound(starts.begin(), starts.end(), begin) -
+                    starts.begin()) -
+             1};
+    for (size_t i{begin}; i < end; ++k) {
+      const size_t last{std::min(end, starts[k + 1])};
+      for (; i < last; ++i)
+        func(k, double(groups[k][i - starts[k]]));
+    }
   }
 
+  // How `ecdf` computes the distribution
+  enum class EcdfMode {
+    EXACT,           // Sort all the values
+    QUANTILE_BOUNDS, // Count the values in ~10⁶ bins instead of sorting
+  };
+
+  /* Plot the empirical cumulative distribution function of the values,
+     i.e., the fraction of values that are ≤ x, using STEPS. Only the
+     points needed at the resolution of the output are written. In
+     EXACT mode the values are copied and sorted with a parallel radix
+     sort; in QUANTILE_BOUNDS mode they are counted in bins whose width
+     is 1/256 of their distance from zero, so that the curve passes
+     exactly through the distribution at the edges of the bins, using
+     much less memory and time. NaNs are ignored. */
   template <typename T>
-  void histogram(const std::vector<T> &values, size_t nbins,
-                 const std::string &label = "",
-                 LineStyle style = LineStyle::BOXES) {
-    assert(nbins > 0);
+  void ecdf(const std::vector<T> &values, const std::string &label = "",
+            EcdfMode mode = EcdfMode::EXACT) {
+    GNUPLOTPP_TRACE_SPAN("plot", label);
+
+    if (!series.empty()) {
+      assert(!is_3dplot);
+    }
+
+    const size_t max_points{2 * display_samples()};
+    std::vector<double> x, fraction;
+    const size_t nchunks{num_chunks(values.size())};
+
+    if (mode == EcdfMode::EXACT) {
+      std::vector<std::uint64_t> keys(values.size());
+      parallel_chunks(keys.size(), nchunks,
+                      [&](size_t, size_t begin, size_t end) {
+                        for (size_t i{begin}; i < end; ++i)
+                          keys[i] = sortable_key(double(values[i]));
+                      });
+      radix_sort(keys);
+
+      // NaNs are sorted before -∞ or after +∞, depending on their sign
+      size_t first{}, last{keys.size()};
+      while (first < last && std::isnan(key_value(keys[first])))
+        ++first;
+      while (last > first && std::isnan(key_value(keys[last - 1])))
+        --last;
+
+      const size_t count{last - first};
+      if (count == 0)
+        return;
+
+      const size_t step{std::max<size_t>(1, count / max_points)};
+      for (size_t i{}; i < count; i += step) {
+        x.push_back(key_value(keys[first + i]));
+        fraction.push_back(double(i + 1) / count);
+      }
+      if (fraction.back() < 1.0) {
+        x.push_back(key_value(keys[last - 1]));
+        fraction.push_back(1.0);
+      }
+    } else {
+      // The 20 most significant bits of the key of a double contain the
+      // sign, the exponent and 8 bits of the mantissa
+      constexpr int SHIFT{44};
+      constexpr size_t NBINS{size_t(1) << (64 - SHIFT)};
+
+      std::vector<std::vector<std::uint32_t>> counts(nchunks);
+      std::vector<size_t> valid(nchunks);
+      std::vector<double> min(nchunks, INFINITY), max(nchunks, -INFINITY);
+      parallel_chunks(values.size(), nchunks,
+                      [&](size_t c, size_t begin, size_t end) {
+                        counts[c].assign(NBINS, 0);
+                        for (size_t i{begin}; i < end; ++i) {
+                          const double value{double(values[i])};
+                          if (std::isnan(value))
+                            continue;
+
+                          ++counts[c][sortable_key(value) >> SHIFT];
+                          min[c] = std::min(min[c], value);
+                          max[c] = std::max(max[c], value);
+                          ++valid[c];
+                        }
+                      });
+
+      size_t count{};
+      for (size_t c{}; c < nchunks; ++c)
+        count += valid[c];
+      if (count == 0)
+        return;
+
+      const double lowest{*std::min_element(min.begin(), min.end())};
+      const double highest{*std::max_element(max.begin(), max.end())};
+      size_t cumulative{}, last_written{};
+      for (size_t bin{}; bin < NBINS && cumulative < count; ++bin) {
+        for (size_t c{}; c < nchunks; ++c)
+          cumulative += counts[c][bin];
+
+        // Always write the first and the last bins, so that the curve
+        // spans the whole range of the values
+        if (cumulative == last_written ||
+            (last_written > 0 && cumulative < count &&
+             cumulative - last_written < count / max_points))
+          continue;
+
+        // All the values counted so far are ≤ the largest number that
+        // falls in this bin
+        const double edge{key_value(((bin + 1) << SHIFT) - 1)};
+        x.push_back(std::max(lowest, std::min(highest, edge)));
+        fraction.push_back(double(cumulative) / count);
+        last_written = cumulative;
+      }
+    }
+
+    plot_points(x, fraction, label, LineStyle::STEPS);
+  }
+
+  // How `bar_aggregate` combines the values with the same key
+  enum class Aggregate {
+    SUM,
+    COUNT,
+    MEAN,
+    MIN,
+    MAX,
+  };
+
+  /* Group the values by key, combine the values in each group, and
+     plot the result as boxes labelled with the keys (which are
+     printed using `operator<<`). If `top_k` is not zero, only the
+     `top_k` groups with the largest results are shown, sorted from
+     the largest to the smallest; otherwise, all of them are shown in
+     the order of the keys. Groups are computed in parallel using a
+     hash table per thread. */
+  template <typename K, typename V>
+  void bar_aggregate(const std::vector<K> &keys, const std::vector<V> &values,
+                     Aggregate agg = Aggregate::SUM, size_t top_k = 0,
+                     const std::string &label = "") {
+    GNUPLOTPP_TRACE_SPAN("plot", label);
 
-    if (values.empty())
+    assert(keys.size() == values.size());
+
+    if (keys.empty())
       return;
 
     if (!series.empty()) {
       assert(!is_3dplot);
     }
 
-    double min = *std::min_element(values.begin(), values.end());
-    double max = *std::max_element(values.begin(), values.end());
-    double binwidth = (max - min) / nbins;
+    const size_t nchunks{num_chunks(keys.size())};
+    std::vector<AggregateTable<K>> tables(nchunks);
+    parallel_chunks(keys.size(), nchunks,
+                    [&](size_t c, size_t begin, size_t end) {
+                      std::hash<K> hasher;
+                      for (size_t i{begin}; i < end; ++i)
+                        tables[c].add(keys[i], hasher(keys[i]),
+                                      double(values[i]));
+                    });
 
-    std::vector<size_t> bins(nbins);
-    for (const auto &val : values) {
-      int index = (val - min) / binwidth;
-      if (index >= int(nbins))
-        --index;
+    // Each thread merges the groups whose hash falls in its partition
+    std::vector<AggregateTable<K>> merged(nchunks);
+    if (nchunks == 1) {
+      merged.swap(tables);
+    } else {
+      parallel_chunks(nchunks, nchunks, [&](size_t part, size_t, size_t) {
+        for (const auto &table : tables) {
+          for (const auto &entry : table.slots) {
+            if (entry.count > 0 && entry.hash % nchunks == part)
+              merged[part].merge(entry);
+          }
+        }
+      });
+    }
+
+    std::vector<std::pair<double, const K *>> groups;
+    for (const auto &table : merged) {
+      for (const auto &entry : table.slots) {
+        if (entry.count == 0)
+          continue;
 
-      bins.at(index)++;
+        double result{};
+        switch (agg) {
+        case Aggregate::COUNT:
+          result = double(entry.count);
+          break;
+        case Aggregate::MEAN:
+          result = entry.sum / entry.count;
+          break;
+        case Aggregate::MIN:
+          result = entry.min;
+          break;
+        case Aggregate::MAX:
+          result = entry.max;
+          break;
+        default:
+          result = entry.sum;
+        }
+        groups.emplace_back(result, &entry.key);
+      }
     }
 
+    if (top_k > 0 && top_k < groups.size()) {
+      std::partial_sort(groups.begin(), groups.begin() + top_k, groups.end(),
+                        [](const std::pair<double, const K *> &a,
+                           const std::pair<double, const K *> &b) {
+                          return a.first > b.first;
+                        });
+      groups.resize(top_k);
+    } else if (top_k > 0) {
+      std::sort(groups.begin(), groups.end(),
+                [](const std::pair<double, const K *> &a,
+                   const std::pair<double, const K *> &b) {
+                  return a.first > b.first;
+                });
+    } else {
+      std::sort(groups.begin(), groups.end(),
+                [](const std::pair<double, const K *> &a,
+                   const std::pair<double, const K *> &b) {
+                  return *a.second < *b.second;
+                });
+    }
+
+    // Labels are strings, so binary files cannot be used
+    GNUPLOTPP_TRACE_SPAN("write", label);
     std::string filename{tmp_file_name()};
     std::ofstream of{filename};
     assert(of.good());
-    for (size_t i{}; i < nbins; ++i) {
-      of << min + binwidth * (i + 0.5) << " " << bins[i] << "\n";
+    for (size_t i{}; i < groups.size(); ++i) {
+      std::ostringstream key;
+      key << *groups[i].second;
+      std::string name{key.str()};
+      std::replace(name.begin(), name.end(), '"', '\'');
+
+      of << i << " " << groups[i].first << " \"" << name << "\"\n";
     }
 
-    series.push_back(GnuplotSeries{filename, style, label, "1:2"});
+    series.push_back(GnuplotSeries{filename, LineStyle::BOXES, label,
+                                   "1:2:xtic(3)", groups.size()});
     is_3dplot = false;
   }
 
@@ -337,9 +1805,253 @@ public:
     return sendcommand(os);
   }
 
-  bool show(bool call_reset = true) {
+  /* Like `multiplot`, but each plot is rendered by a separate Gnuplot
+     process in a pool of `num_workers` processes (default: one per
+     CPU) while your program goes on preparing the next plots. Once
+     all the `nrows × ncols` plots have been shown, the images are
+     pasted together in the final layout. Every command sent after
+     this call and before the last `show` only applies to the current
+     plot, not to the whole figure. Like `GnuplotPool`, this is compiled
+     with GNUPLOTPP_IMPLEMENTATION. */
+  bool parallel_multiplot(int nrows, int ncols, const std::string &title = "",
+                          size_t num_workers = 0);
+
+  bool show(bool call_reset = true);
+
+  /* Like `show`, but never wait for Gnuplot to read the plot command
+     (unless the policy is `Backpressure::BLOCK`): this is meant for
+     plots updated continuously, where Gnuplot might not keep up with
+     the data. If the previous frame has not been sent completely, the
+     new one is handled according to the policy set with
+     `set_backpressure`; with the policies that drop frames, Gnuplot
+     must also have rendered it. Return `false` if the frame was
+     dropped. Call `flush_frames` from time to time to send a frame
+     left waiting. */
+  bool submit_frame(bool call_reset = true);
+
+  /* Send as much as possible of the frames submitted by `submit_frame`
+     without waiting. Return `true` if all of them have been sent. */
+  bool flush_frames();
+
+  // What `submit_frame` does when Gnuplot cannot keep up
+  enum class Backpressure {
+    BLOCK,       // Wait until Gnuplot reads the frame (the default)
+    DROP_OLDEST, // Replace the frame waiting to be sent with the new one
+    DROP_NEWEST, // Discard the new frame
+  };
+
+  void set_backpressure(Backpressure policy) { backpressure = policy; }
+
+  struct FrameStats {
+    // Number of calls to `submit_frame`
+    unsigned long long submitted;
+    // Number of frames that were discarded because of the policy
+    unsigned long long dropped;
+  };
+
+  FrameStats frame_stats() const { return frames; }
+
+  /* Return what is known about the Gnuplot executable, which is
+     queried once when the first `Gnuplot` object using it is created
+     (objects created with `LazyStart` query it when they start it) */
+  const Capabilities &gnuplot_capabilities() const { return capabilities; }
+
+  /* Choose how the data of the next series are passed to Gnuplot. The
+     default is the fastest transport supported by the executable. */
+  void set_data_transport(DataTransport t) {
+    transport = t;
+    transport_set = true;
+  }
+  DataTransport data_transport() const { return transport; }
+
+  /* Save every command passed to `sendcommand` from now on in the file
+     `commands.log` within `directory`, which is created if needed. The
+     data files used by the plots are saved in the same directory, each
+     in a file named after the hash of its contents so that identical
+     data are saved only once. The program `gplotpp-replay` can send the
+     recording to a new Gnuplot process. */
+  bool start_recording(const std::string &directory) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+
+    std::unique_ptr<FileRecorder> recorder{new FileRecorder{directory}};
+    if (!recorder->log.good()) {
+      recording.reset();
+      return false;
+    }
+
+    recorder->log << "# gplot++ " << GNUPLOTPP_MAJOR_VERSION << "."
+                  << GNUPLOTPP_MINOR_VERSION << "." << GNUPLOTPP_PATCH_VERSION
+                  << " recording\n";
+    recording = std::move(recorder);
+    recorded_series = 0;
+    return true;
+  }
+
+  void stop_recording() { recording.reset(); }
+
+  /* Wait until Gnuplot has executed all the commands sent so far,
+     i.e., until the last plot has been rendered. If `timeout` is
+     positive, give up after that many seconds; otherwise, use the
+     timeout set by `set_render_timeout`, if any. When the time is up
+     or Gnuplot crashes, Gnuplot is restarted (see `last_error`).
+     Return `true` if Gnuplot confirmed the completion of the plot.
+     This uses Gnuplot's `set print` command, so it discards any
+     previous `set print`. With a render daemon, this closes the
+     connection, waits for the daemon to reply that the plots are done
+     and connects again, sending the terminal and the settings. */
+  bool wait_until_rendered(double timeout = -1.0);
+
+  /* If Gnuplot does not accept a command within `seconds` (e.g.,
+     because it is stuck rendering a huge plot and the pipe is full),
+     restart it and make `sendcommand` return `false`. A non-positive
+     value means waiting forever, which is the default. */
+  void set_write_timeout(double seconds) { write_timeout = seconds; }
+
+  /* Default timeout for `wait_until_rendered`, which is also used when
+     waiting for Gnuplot to terminate in the destructor. A non-positive
+     value means waiting forever, which is the default. */
+  void set_render_timeout(double seconds) { render_timeout = seconds; }
+
+  /* Description of the last failure that forced the class to restart
+     Gnuplot, or an empty string. The new Gnuplot process receives the
+     terminal, the output file and the settings ("set" and "unset"
+     commands) sent to the previous one. As the output file is opened
+     again, anything already written in it is lost. */
+  const std::string &last_error() const { return error_message; }
+
+  // Number of times Gnuplot has been restarted after a failure
+  unsigned num_restarts() const { return restarts; }
+
+  /* Resources used by the Gnuplot process to render a plot. They are
+     measured between a call to `show` and the next call to
+     `wait_until_rendered` or `show`, and they are only available on
+     Linux. */
+  struct RenderStats {
+    // CPU time (user + system) spent by Gnuplot
+    double cpu_seconds;
+    // Peak of the memory used by Gnuplot, in kB
+    size_t peak_rss_kb;
+    // True if the rendering was stopped because Gnuplot exceeded the
+    // budget set by `set_memory_budget`
+    bool aborted;
+  };
+
+  RenderStats last_render_stats() const { return render_stats; }
+
+  /* Kill Gnuplot if it uses more than `kb` kilobytes of memory while
+     `wait_until_rendered` waits for a plot. Pass zero to remove the
+     limit. */
+  void set_memory_budget(size_t kb) { memory_budget_kb = kb; }
+
+  /* Time elapsed between each call to `show` and the end of the
+     rendering, as measured by `wait_until_rendered`. Plots are grouped
+     by terminal and by number of points. */
+  GnuplotLatencyStats &latency_stats() { return stats; }
+
+  void reset() {
+    series.clear();
+    recorded_series = 0;
+    set_xrange();
+    set_yrange();
+    smoothing = Smoothing{};
+    plot_settings.clear();
+    plot_cleanup.clear();
+    is_3dplot = false;
+  }
+
+private:
+  /* State of a parallel multiplot. The plots are rendered by a
+     GnuplotPool, which is compiled with GNUPLOTPP_IMPLEMENTATION, so
+     the rest of the class only reaches it through these functions. */
+  struct ParallelMultiplot {
+    virtual ~ParallelMultiplot() {}
+
+    // Hand the current plot to the process pool
+    virtual void submit(const std::string &plot_command) = 0;
+    // True once all the plots of the figure have been submitted
+    virtual bool complete() const = 0;
+    // Wait for all the plots and paste them in the final figure
+    virtual bool composite() = 0;
+
+    // Commands sent since the last plot was shown
+    std::stringstream script;
+  };
+
+  // The implementation of `ParallelMultiplot`
+  struct PooledMultiplot;
+
+  /* Exchanges with a render daemon. Only the constructor taking a
+     `DaemonSocket` sets them, so the client is only compiled in the
+     files using it. */
+  struct DaemonLink {
+    // Pass the shared memory files created so far to the daemon
+    bool (Gnuplot::*pass_memfds)();
+    // Wait for the daemon to complete the current job
+    bool (Gnuplot::*finish_job)(double timeout);
+    // Like `finish_job`, then connect again for the next plots
+    bool (Gnuplot::*wait)(double timeout);
+  };
+
+  /* Write a command to the Gnuplot process, bypassing the script of
+     the current panel if a parallel multiplot is active */
+  bool send_to_gnuplot(const char *str) {
+    if (lazy_start)
+      start_lazy_process();
+
+    if (!ok())
+      return false;
+
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+    if (replay_settings) {
+      replay_settings = false;
+      if (!write_to_connection(settings_script()))
+        return false;
+    }
+
+    if (!memfds_to_pass.empty() && std::strstr(str, "/proc/self/fd/") &&
+        !(this->*daemon_link->pass_memfds)())
+      return false;
+#endif
+
+#ifndef _WIN32
+    // Complete the frames sent by `submit_frame` first
+    if (!send_pending_frames())
+      return false;
+#endif
+
+    GNUPLOTPP_TRACE_SPAN("sendcommand", current_terminal);
+    std::string command{str};
+    command.push_back('\n');
+    if (!write_to_connection(command)) {
+      restart_process("Unable to send a command to Gnuplot");
+      return false;
+    }
+
+    return true;
+  }
+
+  /* Build the command that plots the series, and write any data file
+     that is still missing */
+  std::string prepare_plot_command() {
+    write_shared_tables();
+    write_memory_series();
+    if (recording) {
+      // Each series is copied once, when it is first plotted: file names
+      // can be reused (e.g., `/proc/self/fd/N`), so they are not a key
+      for (; recorded_series < series.size(); ++recorded_series) {
+        const std::string &filename{series[recorded_series].filename};
+        if (recorded_series == 0 ||
+            filename != series[recorded_series - 1].filename)
+          recording->payload(filename);
+      }
+    }
+
     std::stringstream os;
-    os << "set style fill solid 0.5\n";
+    os << "set style fill solid 0.5\n" << plot_settings;
 
     if (is_3dplot) {
       os << "splot " << xrange << " " << yrange << " " << zrange << " ";
@@ -348,7 +2060,10 @@ public:
     }
     for (size_t i{}; i < series.size(); ++i) {
       const GnuplotSeries &s = series.at(i);
-      os << "'" << s.filename << "' using " << s.column_range << " with "
+      os << "'" << s.filename << "' ";
+      if (!s.binary_format.empty())
+        os << s.binary_format << " ";
+      os << "using " << s.column_range << " with "
          << style_to_str(s.line_style) << " title '" << escape_quotes(s.title)
          << "'";
 
@@ -356,60 +2071,3648 @@ public:
         os << ", ";
     }
 
-    bool result = sendcommand(os);
-    if (result && call_reset)
-      reset();
+    // Undo the settings used only by this plot
+    if (!plot_cleanup.empty())
+      os << "\n" << plot_cleanup.substr(0, plot_cleanup.size() - 1);
+
+    return os.str();
+  }
 
+  size_t num_points() const {
+    size_t result{};
+    for (const auto &s : series)
+      result += s.num_points;
     return result;
   }
 
-  void reset() {
-    series.clear();
-    set_xrange();
-    set_yrange();
-    is_3dplot = false;
+  // Start measuring a plot which is being sent to Gnuplot
+  void start_plot_stats(size_t points) {
+    start_render_stats();
+    last_show_time = std::chrono::steady_clock::now();
+    last_show_points = points;
   }
 
-private:
-  struct GnuplotSeries {
-    std::string filename;
-    LineStyle line_style;
-    std::string title;
-    std::string column_range;
-  };
+#ifndef _WIN32
+  /* Write as many bytes as the pipe can accept without waiting, and
+     save their number in `written`. Return `false` on errors. */
+  bool write_available(const char *data, size_t size, size_t &written) {
+    SigpipeBlocker blocker;
+    written = 0;
+    while (written < size) {
+      ssize_t nbytes{write(fileno(connection), data + written, size - written)};
+      if (nbytes > 0) {
+        written += nbytes;
+      } else if (nbytes < 0 && errno == EINTR) {
+        continue;
+      } else {
+        return nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      }
+    }
+
+    return true;
+  }
+
+  // Send the frames still waiting, blocking if needed
+  bool send_pending_frames() {
+    if (frame_in_progress.empty() && queued_frame.empty())
+      return true;
+
+    std::string rest{frame_in_progress.substr(frame_offset)};
+    frame_in_progress.clear();
+    frame_offset = 0;
+    if (!queued_frame.empty()) {
+      start_frame(std::move(queued_frame), queued_frame_points);
+      queued_frame.clear();
+      rest += frame_in_progress;
+      frame_in_progress.clear();
+    }
+
+    if (!write_to_connection(rest)) {
+      restart_process("Unable to send a frame to Gnuplot");
+      return false;
+    }
+
+    return true;
+  }
+#endif
+
+  /* Write all of `data` to the pipe (or socket), giving up when the
+     write timeout expires. The descriptor is non-blocking, so that a
+     Gnuplot process which stopped reading cannot block us forever. */
+  bool write_to_connection(const std::string &data) {
+    return write_all(connection, data, write_timeout);
+  }
+
+  // Like `write_to_connection`, with a timeout in seconds (if positive)
+  static bool write_all(FILE *connection, const std::string &data,
+                        double timeout) {
+#ifdef _WIN32
+    (void)timeout;
+    fputs(data.c_str(), connection);
+    return fflush(connection) == 0;
+#else
+    const int fd{fileno(connection)};
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration<double>(timeout);
+
+    SigpipeBlocker blocker;
+    size_t written{};
+    while (written < data.size()) {
+      ssize_t nbytes{write(fd, data.data() + written, data.size() - written)};
+      if (nbytes > 0) {
+        written += nbytes;
+        continue;
+      }
+      if (nbytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+          errno != EINTR)
+        return false;
+
+      // The pipe is full: wait until Gnuplot reads something
+      int wait_ms{-1};
+      if (timeout > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+          return false;
+        wait_ms = int(left.count());
+      }
+
+      pollfd pfd{fd, POLLOUT, 0};
+      poll(&pfd, 1, wait_ms);
+    }
+
+    return true;
+#endif
+  }
+
+#ifndef _WIN32
+  /* Writing to a pipe whose reader has died raises SIGPIPE, which
+     would kill the program: block it in this thread while writing, and
+     discard it if it was raised. */
+  class SigpipeBlocker {
+  public:
+    SigpipeBlocker() : blocked{}, previous{} {
+      sigemptyset(&blocked);
+      sigaddset(&blocked, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    }
+
+    ~SigpipeBlocker() {
+      // A SIGPIPE raised by a failed write is pending for this thread:
+      // consume it, or unblocking it would kill the process
+      sigset_t pending;
+      sigemptyset(&pending);
+      if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+        int signal_number;
+        sigwait(&blocked, &signal_number);
+      }
+      pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+  private:
+    sigset_t blocked, previous;
+  };
+#endif
+
+  /* Remember the "set" and "unset" commands in `str`, so that they
+     can be sent again to a restarted Gnuplot. Only the last command
+     changing each setting is kept. */
+  void remember_settings(const char *str) {
+    std::istringstream is{str};
+    std::string line;
+    while (std::getline(is, line)) {
+      std::istringstream words{line};
+      std::string verb, name, detail;
+      words >> verb >> name >> detail;
+      if ((verb != "set" && verb != "unset") || name.empty() ||
+          name == "terminal" || name == "output" || name == "print" ||
+          name == "multiplot")
+        continue;
+
+      // Settings like "style" and "label" have several instances
+      const std::string key{name == "style" || name == "label" ||
+                                    name == "arrow" || name == "object"
+                                ? name + " " + detail
+                                : name};
+      auto it = std::find_if(
+          settings.begin(), settings.end(),
+          [&key](const std::pair<std::string, std::string> &setting) {
+            return setting.first == key;
+          });
+      if (it == settings.end())
+        settings.emplace_back(key, line);
+      else
+        it->second = line;
+    }
+  }
+
+  /* Kill Gnuplot and start a new process, restoring the terminal, the
+     output file and the settings sent so far. Setting the output file
+     again truncates it, so pages already written to a PDF are lost. */
+  void restart_process(const std::string &reason) {
+    error_message = reason;
+    if (daemon_client || !connection) {
+      if (connection) {
+        fclose(connection);
+        connection = nullptr;
+      }
+      return;
+    }
+
+#ifndef _WIN32
+    if (child_pid > 0)
+      kill(child_pid, SIGKILL);
+#endif
+    stop_process();
+    start_process(process_command);
+    ++restarts;
+
+    // Acknowledgements still due will never arrive
+    acks_received = num_acks;
+    ack_line.clear();
+
+    if (connection)
+      write_to_connection(settings_script());
+  }
+
+  // Commands that bring a new Gnuplot process to the current state
+  std::string settings_script() const {
+    return init_commands + "\n" + terminal_commands + remembered_settings();
+  }
+
+  // The commands kept by `remember_settings`, one per line
+  std::string remembered_settings() const {
+    std::string commands;
+    for (const auto &setting : settings)
+      commands += setting.second + "\n";
+    return commands;
+  }
+
+  void record_render_latency() {
+    // Only the first acknowledgement after a plot measures its latency
+    if (last_show_points == 0)
+      return;
+
+    std::stringstream category;
+    category << "terminal=" << current_terminal << " points=";
+    if (last_show_points < 1000) {
+      category << "<1e3";
+    } else {
+      int decade{int(std::log10(double(last_show_points)))};
+      category << "1e" << decade << "-1e" << decade + 1;
+    }
+
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          last_show_time};
+    stats.record(category.str(), elapsed.count());
+    last_show_points = 0;
+  }
+
+  /* Recording made by `start_recording`. Its functions are only called
+     through this interface, so that they are compiled only in the
+     files calling `start_recording`. */
+  struct Recorder {
+    virtual ~Recorder() {}
+
+    /* Append a command to the recording, replacing the names of the
+       data files with the names of their copies */
+    virtual void command(const char *str) = 0;
+    /* Save a copy of a data file in the recording directory, unless a
+       file with the same contents is already there */
+    virtual void payload(const std::string &filename) = 0;
+  };
+
+  struct FileRecorder : public Recorder {
+    explicit FileRecorder(const std::string &dir)
+        : log{dir + "/commands.log"}, directory{dir},
+          start{std::chrono::steady_clock::now()}, payloads{} {}
+
+    void command(const char *str) override {
+      // File names are always quoted, so only quoted strings are
+      // looked up
+      std::string copy;
+      for (const char *cur{str}; *cur != '\0';) {
+        const char *end{cur[0] == '\'' ? std::strchr(cur + 1, '\'') : nullptr};
+        if (end == nullptr) {
+          copy += *cur++;
+          continue;
+        }
+
+        const std::string filename{cur + 1, end};
+        auto entry = find_payload(filename);
+        if (entry != payloads.end() && entry->first == filename)
+          copy += "'" + entry->second + "'";
+        else
+          copy.append(cur, end + 1);
+        cur = end + 1;
+      }
+
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+      log << elapsed.count() << " " << copy.size() << "\n" << copy << "\n";
+      log.flush();
+    }
+
+    void payload(const std::string &filename) override {
+      std::ifstream in{filename, std::ios::binary};
+      std::string contents{std::istreambuf_iterator<char>{in},
+                           std::istreambuf_iterator<char>{}};
+
+      // 64-bit FNV-1a hash
+      unsigned long long hash{14695981039346656037ULL};
+      for (char c : contents) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+      }
+
+      char name[32];
+      std::snprintf(name, sizeof(name), "%016llx.dat", hash);
+      std::string path{directory + "/" + name};
+      if (!std::ifstream{path}.good())
+        std::ofstream{path, std::ios::binary} << contents;
+
+      auto entry = find_payload(filename);
+      if (entry == payloads.end() || entry->first != filename)
+        entry = payloads.emplace(entry, filename, "");
+      entry->second = std::string{"@DATA@/"} + name;
+    }
+
+    /* Return the element of `payloads` for a data file, or the position
+       where it should be inserted */
+    std::vector<std::pair<std::string, std::string>>::iterator
+    find_payload(const std::string &filename) {
+      return std::lower_bound(
+          payloads.begin(), payloads.end(), filename,
+          [](const std::pair<std::string, std::string> &payload,
+             const std::string &name) { return payload.first < name; });
+    }
+
+    std::ofstream log;
+    std::string directory;
+    std::chrono::steady_clock::time_point start;
+    // Name of each data file → name of its latest copy in the
+    // recording, sorted by the name of the data file
+    std::vector<std::pair<std::string, std::string>> payloads;
+  };
+
+  /* Start the Gnuplot process of an object created with `LazyStart`,
+     and send it the commands received so far */
+  void start_lazy_process() {
+    lazy_start = false;
+    capabilities = probe_capabilities(executable);
+    if (!transport_set)
+      transport = capabilities.supports_binary_data() ? DataTransport::BINARY
+                                                      : DataTransport::TEXT;
+
+    // Use the fallback if the terminal chosen before probing is missing
+    const std::string preferred{unchecked_terminal.first};
+    const std::string fallback{unchecked_terminal.second};
+    const std::string set_terminal{"set terminal "};
+    size_t pos{terminal_commands.find(set_terminal + preferred)};
+    if (!preferred.empty() && pos != std::string::npos &&
+        available_terminal(preferred, fallback) != preferred) {
+      terminal_commands.replace(pos + set_terminal.size(), preferred.size(),
+                                fallback);
+      if (png_terminal == preferred)
+        png_terminal = fallback;
+      current_terminal = fallback.substr(0, fallback.find(' '));
+    }
+
+    start_process(process_command);
+
+    std::string commands{std::move(deferred_commands)};
+    deferred_commands.clear();
+    if (commands.find(terminal_commands) == std::string::npos)
+      commands += terminal_commands;
+    while (!commands.empty() && commands.back() == '\n')
+      commands.pop_back();
+    if (connection && !commands.empty())
+      send_to_gnuplot(commands.c_str());
+  }
+
+  // Start Gnuplot, keeping track of its PID where possible
+  void start_process(const std::string &command) {
+    process_command = command;
+    connection = spawn_process(command, child_pid);
+  }
+
+  /* Run `command` and return a pipe connected to its standard input;
+     `pid` is set to the PID of the process, or to -1 if it is not
+     known */
+  static FILE *spawn_process(const std::string &command, long &pid) {
+    pid = -1;
+#ifdef _WIN32
+    return popen(command.c_str(), "w");
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+      return nullptr;
+
+    // Using "exec" makes Gnuplot replace the shell, so that the PID
+    // returned by fork is the one of Gnuplot
+    const std::string shell_command{"exec " + command};
+    pid = fork();
+    if (pid == 0) {
+      dup2(fds[0], STDIN_FILENO);
+      close(fds[0]);
+      close(fds[1]);
+      execl("/bin/sh", "sh", "-c", shell_command.c_str(), (char *)nullptr);
+      _exit(127);
+    }
+
+    close(fds[0]);
+    if (pid < 0) {
+      close(fds[1]);
+      return nullptr;
+    }
+
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    return fdopen(fds[1], "w");
+#endif
+  }
+
+  // Close the pipe to Gnuplot and wait for it to terminate
+  void stop_process() {
+    close_process(connection, child_pid, render_timeout);
+    child_pid = -1;
+    connection = nullptr;
+  }
+
+  /* Close the pipe to a process started by `spawn_process` and wait
+     for it to terminate. If `timeout` is positive, give the process
+     that many seconds to complete the last plot, then kill it. Return
+     true if the process exited with status 0. */
+  static bool close_process(FILE *connection, long pid, double timeout) {
+#ifdef _WIN32
+    (void)pid;
+    (void)timeout;
+    return pclose(connection) == 0;
+#else
+    fclose(connection);
+    if (pid <= 0)
+      return false;
+
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration<double>(timeout);
+    int status{};
+    pid_t result{};
+    while (timeout > 0 && (result = waitpid(pid, &status, WNOHANG)) == 0) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        kill(pid, SIGKILL);
+        break;
+      }
+      usleep(10000);
+    }
+
+    if (result != pid) {
+      while ((result = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+        ;
+    }
+    return result == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+  }
+
+  /* Read the CPU time (in seconds) and the current and peak memory
+     usage (in kB) of the Gnuplot process from /proc */
+  bool read_process_usage(double &cpu_seconds, size_t &rss_kb,
+                          size_t &peak_rss_kb) const {
+#ifdef __linux__
+    if (child_pid <= 0)
+      return false;
+
+    const std::string proc{"/proc/" + std::to_string(child_pid)};
+    std::ifstream stat{proc + "/stat"};
+    std::string contents;
+    if (!std::getline(stat, contents))
+      return false;
+
+    // Skip the PID and the executable name, which may contain spaces;
+    // utime and stime are the 14th and 15th fields
+    std::istringstream fields{contents.substr(contents.rfind(')') + 2)};
+    std::string field;
+    unsigned long long utime{}, stime{};
+    for (int i{3}; i <= 13; ++i)
+      fields >> field;
+    fields >> utime >> stime;
+    cpu_seconds = double(utime + stime) / sysconf(_SC_CLK_TCK);
+
+    std::ifstream status{proc + "/status"};
+    std::string line;
+    rss_kb = peak_rss_kb = 0;
+    while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmRSS:") == 0)
+        rss_kb = std::strtoull(line.c_str() + 6, nullptr, 10);
+      else if (line.compare(0, 6, "VmHWM:") == 0)
+        peak_rss_kb = std::strtoull(line.c_str() + 6, nullptr, 10);
+    }
+
+    return true;
+#else
+    (void)cpu_seconds;
+    (void)rss_kb;
+    (void)peak_rss_kb;
+    return false;
+#endif
+  }
+
+  void start_render_stats() {
+    if (measuring_render)
+      finish_render_stats();
+
+    size_t rss_kb{}, peak_rss_kb{};
+    measuring_render =
+        read_process_usage(render_cpu_start, rss_kb, peak_rss_kb);
+
+#ifdef __linux__
+    // Reset the peak memory usage, so that it only refers to this plot
+    if (measuring_render)
+      std::ofstream{"/proc/" + std::to_string(child_pid) + "/clear_refs"}
+          << "5";
+#endif
+  }
+
+  void finish_render_stats() {
+    if (!measuring_render)
+      return;
+
+    double cpu_seconds{};
+    size_t rss_kb{}, peak_rss_kb{};
+    if (read_process_usage(cpu_seconds, rss_kb, peak_rss_kb)) {
+      render_stats.cpu_seconds = cpu_seconds - render_cpu_start;
+      render_stats.peak_rss_kb = peak_rss_kb;
+      render_stats.aborted = false;
+    }
+    measuring_render = false;
+  }
+
+  bool exceeds_memory_budget() const {
+    double cpu_seconds{};
+    size_t rss_kb{}, peak_rss_kb{};
+    return read_process_usage(cpu_seconds, rss_kb, peak_rss_kb) &&
+           rss_kb > memory_budget_kb;
+  }
+
+#ifndef _WIN32
+  // Commands that make Gnuplot write acknowledgement number `n`
+  std::string ack_commands(unsigned n) const {
+    return "set print '" + ack_fifo + "'\nprint 'gplotpp-ack " +
+           std::to_string(n) + "'\nunset print";
+  }
+
+  /* Read the acknowledgements written by Gnuplot so far without
+     waiting, and keep the number of the last one */
+  void read_acks() {
+    char buffer[256];
+    ssize_t nbytes;
+    while (ack_fds[0] >= 0 &&
+           (nbytes = read(ack_fds[0], buffer, sizeof(buffer))) > 0) {
+      for (ssize_t i{}; i < nbytes; ++i) {
+        if (buffer[i] != '\n') {
+          ack_line.push_back(buffer[i]);
+          continue;
+        }
+
+        unsigned n{};
+        if (std::sscanf(ack_line.c_str(), "gplotpp-ack %u", &n) == 1)
+          acks_received = std::max(acks_received, n);
+        ack_line.clear();
+      }
+    }
+  }
+
+  /* Return `true` if Gnuplot has rendered the last frame sent by
+     `submit_frame` (always, with `Backpressure::BLOCK`) */
+  bool frame_rendered() {
+    read_acks();
+    return acks_received >= frame_ack;
+  }
+
+  /* Start sending a frame. With the policies that drop frames, Gnuplot
+     acknowledges each frame once rendered, and the next one waits for
+     it: otherwise the pipe would hold hundreds of frames before any
+     of them was dropped. */
+  void start_frame(std::string command, size_t points) {
+    if (recording)
+      recording->command(command.substr(0, command.size() - 1).c_str());
+    if (backpressure != Backpressure::BLOCK && open_ack_fifo()) {
+      frame_ack = ++num_acks;
+      command += ack_commands(frame_ack) + "\n";
+    }
+
+    start_plot_stats(points);
+    frame_in_progress = std::move(command);
+    frame_offset = 0;
+  }
+
+  /* Create the named pipe used by Gnuplot to notify the completion of
+     a plot. Both ends are kept open, so that reads never report an
+     end-of-file when Gnuplot closes its side. */
+  bool open_ack_fifo() {
+    if (ack_fds[0] >= 0)
+      return true;
+
+    ack_fifo = tmp_file_name();
+    if (mkfifo(ack_fifo.c_str(), 0600) != 0)
+      return false;
+
+    ack_fds[0] = open(ack_fifo.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    ack_fds[1] = open(ack_fifo.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    return ack_fds[0] >= 0 && ack_fds[1] >= 0;
+  }
+#endif
+
+  void initialize() {
+    set_xrange();
+    set_yrange();
+    set_zrange();
+
+    // See
+    // https://stackoverflow.com/questions/28152719/how-to-make-gnuplot-use-the-unicode-minus-sign-for-negative-numbers
+    sendcommand(init_commands);
+  }
+
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+  static std::string memfd_path(int fd) {
+    return "/proc/self/fd/" + std::to_string(fd);
+  }
+
+  bool connect_to_daemon() {
+    int sock{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, daemon_path.c_str(),
+                 sizeof(addr.sun_path) - 1);
+
+    if (sock >= 0 &&
+        connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ==
+            0) {
+      fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+      connection = fdopen(sock, "w");
+    } else if (sock >= 0) {
+      close(sock);
+    }
+
+    return connection != nullptr;
+  }
+
+  // Send a message to the daemon, waiting if the socket buffer is full
+  bool send_to_daemon(const std::string &text, int fd = -1) {
+    char control[CMSG_SPACE(sizeof(int))]{};
+    size_t sent{};
+    while (sent < text.size()) {
+      iovec iov{const_cast<char *>(text.data()) + sent, text.size() - sent};
+      msghdr msg{};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      // The descriptor goes with the first byte of the message
+      if (fd >= 0 && sent == 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr *cmsg{CMSG_FIRSTHDR(&msg)};
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+      }
+
+      ssize_t nbytes{sendmsg(fileno(connection), &msg, MSG_NOSIGNAL)};
+      if (nbytes >= 0) {
+        sent += size_t(nbytes);
+      } else if (errno == EAGAIN || errno == EINTR) {
+        pollfd pfd{fileno(connection), POLLOUT, 0};
+        poll(&pfd, 1, -1);
+      } else {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Copy the contents of a shared memory file into a file on disk
+  static bool copy_memfd(int fd, const std::string &filename) {
+    std::ofstream out{filename, std::ios::binary};
+    char buffer[65536];
+    off_t offset{};
+    ssize_t nbytes;
+    while ((nbytes = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+      out.write(buffer, nbytes);
+      offset += nbytes;
+    }
+
+    return nbytes == 0 && out.good();
+  }
+
+  /* Send the descriptors of the shared memory files created so far to
+     the daemon. Each descriptor is announced by a comment carrying its
+     number in this process, which the daemon uses to replace the path
+     returned by `memfd_path` with one it can open. If a descriptor
+     cannot be passed, its contents are saved in a temporary file and
+     the comment announces the path of the file instead. */
+  bool pass_memfds() {
+    fflush(connection);
+
+    bool result{true};
+    for (int fd : memfds_to_pass) {
+      if (result &&
+          !send_to_daemon("# gplotpp-fd " + std::to_string(fd) + "\n", fd)) {
+        if (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN) {
+          restart_process("The connection to the daemon was closed");
+          result = false;
+        } else {
+          std::string filename{disk_file_name()};
+          if (!copy_memfd(fd, filename) ||
+              !send_to_daemon("# gplotpp-file " + std::to_string(fd) + " " +
+                              filename + "\n")) {
+            restart_process("Unable to pass the data to the daemon");
+            result = false;
+          }
+        }
+      }
+      close(fd);
+    }
+
+    memfds_to_pass.clear();
+    return result;
+  }
+
+  /* Tell the daemon that there are no more commands, and wait until it
+     replies that it has run them. The connection is closed. */
+  bool finish_daemon_job(double timeout) {
+    if (!connection)
+      return false;
+
+    fflush(connection);
+    int sock{fileno(connection)};
+    shutdown(sock, SHUT_WR);
+
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration<double>(timeout);
+    std::string reply;
+    char buffer[256];
+    while (reply.find('\n') == std::string::npos) {
+      int wait_ms{-1};
+      if (timeout > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+          break;
+        wait_ms = int(left.count());
+      }
+
+      pollfd pfd{sock, POLLIN, 0};
+      if (poll(&pfd, 1, wait_ms) < 0 && errno != EINTR)
+        break;
+
+      ssize_t nbytes{read(sock, buffer, sizeof(buffer))};
+      if (nbytes > 0)
+        reply.append(buffer, nbytes);
+      else if (nbytes == 0 || (errno != EAGAIN && errno != EINTR))
+        break;
+    }
+
+    fclose(connection);
+    connection = nullptr;
+
+    if (reply.compare(0, 16, "gplotpp-done ok\n") != 0) {
+      error_message = reply.empty()
+                          ? "The daemon did not reply in time"
+                          : "The daemon was unable to render the plot";
+      return false;
+    }
+
+    return true;
+  }
+
+  /* Wait for the daemon to render the commands sent so far, then open
+     a new connection. The terminal, the output file and the settings
+     are sent again with the next command: setting the output file
+     truncates it, so this must not happen unless there is a new plot. */
+  bool wait_for_daemon(double timeout) {
+    bool result{finish_daemon_job(timeout)};
+    replay_settings = true;
+    return connect_to_daemon() && result;
+  }
+#endif
+
+  // Hand the current plot of a parallel multiplot to the process pool
+  bool submit_panel(const std::string &plot_command) {
+    panels->submit(plot_command);
+    return !panels->complete() || composite_panels();
+  }
+
+  /* Wait for all the plots of a parallel multiplot to be rendered and
+     paste them in the final figure */
+  bool composite_panels() {
+    std::unique_ptr<ParallelMultiplot> mp{std::move(panels)};
+    return mp->composite();
+  }
+
+  struct GnuplotSeries {
+    std::string filename;
+    LineStyle line_style;
+    std::string title;
+    std::string column_range;
+    size_t num_points;
+    // Index in `shared_tables`, if the data file is shared
+    size_t shared_table;
+    // Empty if the data file is a text file
+    std::string binary_format;
+    // Points kept in memory by a Gnuplot object that has not been
+    // started yet; `x` is empty if the points are numbered from 0
+    std::vector<double> x, y;
+
+    GnuplotSeries(const std::string &file, LineStyle style,
+                  const std::string &series_title, const std::string &columns,
+                  size_t npoints)
+        : filename{file}, line_style{style}, title{series_title},
+          column_range{columns}, num_points{npoints}, shared_table{NOT_SHARED},
+          binary_format{}, x{}, y{} {}
+  };
+
+  static constexpr size_t NOT_SHARED = size_t(-1);
+
+  // Write the element of a column in a given row
+  struct ColumnWriter {
+    const void *column;
+    void (*write)(std::ostream &os, const void *column, size_t row);
+
+    void operator()(std::ostream &os, size_t row) const {
+      write(os, column, row);
+    }
+  };
+
+  struct SharedTable {
+    std::vector<ColumnWriter> columns;
+    size_t nrows;
+    std::string filename;
+    // Number of columns contained in the file, if it has been written
+    size_t columns_written;
+  };
+
+  // Values are written in their own type, so that, e.g., 64-bit
+  // integers are not rounded
+  template <typename T>
+  static ColumnWriter column_writer(const std::vector<T> &column) {
+    return ColumnWriter{&column, write_element<T>};
+  }
+
+  template <typename T>
+  static void write_element(std::ostream &os, const void *column,
+                            size_t row) {
+    os << (*static_cast<const std::vector<T> *>(column))[row];
+  }
+
+  /* Write the data files of shared columns that are going to be
+     plotted, unless they are already up to date */
+  void write_shared_tables() {
+    for (auto &s : series) {
+      if (s.shared_table == NOT_SHARED)
+        continue;
+
+      SharedTable &table = shared_tables[s.shared_table];
+      if (table.columns_written != table.columns.size()) {
+        GNUPLOTPP_TRACE_SPAN("write", "shared");
+
+        // Always use a new file, as a Gnuplot process might still be
+        // reading the old one
+        table.filename = tmp_file_name();
+        std::ofstream of{table.filename};
+        assert(of.good());
+
+        for (size_t row{}; row < table.nrows; ++row) {
+          for (size_t col{}; col < table.columns.size(); ++col) {
+            if (col > 0)
+              of << " ";
+            table.columns[col](of, row);
+          }
+          of << "\n";
+        }
+
+        table.columns_written = table.columns.size();
+      }
+
+      s.filename = table.filename;
+    }
+  }
+
+  /* Keep the points of a series in memory, so that `render_native` can
+     draw them; `x` is null if the points are numbered from 0 */
+  template <typename T, typename U>
+  void add_memory_series(const std::vector<T> *x, const std::vector<U> &y,
+                         const std::string &label, LineStyle style) {
+    GnuplotSeries s{"", style, label, x ? "1:2" : "0:1", y.size()};
+    if (x)
+      s.x.assign(x->begin(), x->end());
+
+    if (smoothing.kind != Smoothing::Kind::NONE) {
+      SmoothingFilter filter{smoothing_start, smoothing, y};
+      s.y.resize(y.size());
+      for (auto &value : s.y)
+        value = filter.next();
+    } else {
+      s.y.assign(y.begin(), y.end());
+    }
+
+    series.push_back(std::move(s));
+    is_3dplot = false;
+  }
+
+  /* Write the data files of the series kept in memory, as they must
+     be plotted by Gnuplot */
+  void write_memory_series() {
+    for (auto &s : series) {
+      if (s.y.empty() || !s.filename.empty())
+        continue;
+
+      GNUPLOTPP_TRACE_SPAN("write", s.title);
+      s.filename = tmp_file_name();
+      if (transport == DataTransport::BINARY && s.x.empty()) {
+        write_binary(s.filename, s.y.size(), s.y.data());
+      } else if (transport == DataTransport::BINARY) {
+        write_binary(s.filename, s.y.size(), s.x.data(), s.y.data());
+      } else {
+        std::ofstream of{s.filename};
+        assert(of.good());
+        for (size_t i{}; i < s.y.size(); ++i) {
+          if (!s.x.empty())
+            of << s.x[i] << " ";
+          of << s.y[i] << "\n";
+        }
+      }
+      s.binary_format = binary_format(s.x.empty() ? 1 : 2);
+    }
+  }
+
+  /* Produce the smoothed values of `y` one at a time, in O(1) time per
+     point for averages and in O(window) for the median, which keeps
+     the window sorted */
+  class SmoothingFilter {
+  public:
+    /* Function filling the window before the first point, saved by
+       `set_smoothing`: the filters are only compiled in the files
+       using them */
+    using Start = void (*)(SmoothingFilter &);
+
+    // Elements are read one at a time, so `values` can be a vector<bool>
+    template <typename T>
+    SmoothingFilter(Start start, const Smoothing &filter,
+                    const std::vector<T> &values)
+        : params{filter}, column{&values}, value_at{element_value<T>},
+          n{values.size()}, next_index{}, half{}, sum{}, state{NAN},
+          finite{}, sorted{}, weights{}, advance{} {
+      start(*this);
+    }
+
+    double next() { return advance(*this); }
+
+    static void start(SmoothingFilter &filter) {
+      filter.init();
+      filter.advance = step;
+    }
+
+  private:
+    template <typename T>
+    static double element_value(const void *column, size_t i) {
+      return double((*static_cast<const std::vector<T> *>(column))[i]);
+    }
+
+    static double step(SmoothingFilter &filter) { return filter.compute(); }
+
+    double y(size_t i) const { return value_at(column, i); }
+
+    void init() {
+      using Kind = Smoothing::Kind;
+
+      half = params.window / 2;
+      if (params.kind == Kind::MOVING_AVERAGE) {
+        for (size_t i{}; i < std::min(half, n); ++i)
+          add(y(i));
+      } else if (params.kind == Kind::MEDIAN) {
+        for (size_t i{}; i < std::min(half, n); ++i)
+          insert(y(i));
+      } else if (params.kind == Kind::SAVITZKY_GOLAY) {
+        compute_weights();
+      }
+    }
+
+    double compute() {
+      using Kind = Smoothing::Kind;
+      const size_t i{next_index++};
+
+      switch (params.kind) {
+      case Kind::MOVING_AVERAGE: {
+        // Running sum over [i - half, i + half], clipped to [0, n)
+        if (i + half < n)
+          add(y(i + half));
+        if (i > half)
+          remove(y(i - half - 1));
+        return mean();
+      }
+      case Kind::TRAILING_AVERAGE: {
+        add(y(i));
+        if (i >= params.window)
+          remove(y(i - params.window));
+        return mean();
+      }
+      case Kind::EXPONENTIAL: {
+        // The state starts from the first finite value and is left
+        // unchanged by values that are not finite
+        const double value{y(i)};
+        if (std::isfinite(value))
+          state = std::isnan(state)
+                      ? value
+                      : params.alpha * value + (1 - params.alpha) * state;
+        return state;
+      }
+      case Kind::MEDIAN:
+        if (i + half < n)
+          insert(y(i + half));
+        if (i > half)
+          erase(y(i - half - 1));
+        if (sorted.empty())
+          return NAN;
+        if (sorted.size() % 2 == 1)
+          return sorted[sorted.size() / 2];
+        return (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+      case Kind::SAVITZKY_GOLAY: {
+        // Near the ends, the polynomial fitted to the first (last)
+        // window is evaluated at the position of the point
+        const size_t width{params.window};
+        if (n < width)
+          return y(i);
+
+        size_t first{i > half ? i - half : 0};
+        first = std::min(first, n - width);
+        const double *w{weights.data() + (i - first) * width};
+        double result{};
+        for (size_t j{}; j < width; ++j)
+          result += w[j] * y(first + j);
+        return result;
+      }
+      default:
+        return y(i);
+      }
+    }
+
+    // Like the median, the averages leave out values that are not
+    // finite, so that a NaN does not spread to every later point
+    void add(double value) {
+      if (std::isfinite(value)) {
+        sum += value;
+        ++finite;
+      }
+    }
+
+    void remove(double value) {
+      if (std::isfinite(value)) {
+        sum -= value;
+        --finite;
+      }
+    }
+
+    double mean() const { return finite > 0 ? sum / double(finite) : NAN; }
+
+    // Values that are not finite are left out of the window, as NaN
+    // cannot be ordered
+    void insert(double value) {
+      if (std::isfinite(value))
+        sorted.insert(std::lower_bound(sorted.begin(), sorted.end(), value),
+                      value);
+    }
+
+    void erase(double value) {
+      if (std::isfinite(value))
+        sorted.erase(std::lower_bound(sorted.begin(), sorted.end(), value));
+    }
+
+    /* weights[t * window + j] is the weight of the j-th point of a
+       window in the value of the polynomial fitted to the window,
+       evaluated at the t-th point */
+    void compute_weights() {
+      const size_t width{params.window};
+      const size_t nterms{size_t(params.order) + 1};
+      const double scale{half > 0 ? 1.0 / half : 1.0};
+
+      // Powers of the (scaled) position of each point in the window
+      std::vector<double> powers(width * nterms);
+      for (size_t j{}; j < width; ++j) {
+        double z{(double(j) - double(half)) * scale}, p{1.0};
+        for (size_t k{}; k < nterms; ++k, p *= z)
+          powers[j * nterms + k] = p;
+      }
+
+      // Column j of (AᵀA)⁻¹ Aᵀ gives the coefficients of the fit when
+      // the j-th point is 1 and all the others are 0
+      std::vector<double> ata(nterms * nterms);
+      for (size_t r{}; r < nterms; ++r) {
+        for (size_t c{}; c < nterms; ++c) {
+          for (size_t j{}; j < width; ++j)
+            ata[r * nterms + c] +=
+                powers[j * nterms + r] * powers[j * nterms + c];
+        }
+      }
+
+      weights.assign(width * width, 0.0);
+      for (size_t j{}; j < width; ++j) {
+        std::vector<double> a{ata};
+        std::vector<double> coeffs(powers.begin() + j * nterms,
+                                   powers.begin() + (j + 1) * nterms);
+        solve_linear_system(a, coeffs);
+
+        for (size_t t{}; t < width; ++t) {
+          double value{};
+          for (size_t k{}; k < nterms; ++k)
+            value += coeffs[k] * powers[t * nterms + k];
+          weights[t * width + j] = value;
+        }
+      }
+    }
+
+    Smoothing params;
+    const void *column;
+    double (*value_at)(const void *, size_t);
+    size_t n, next_index, half;
+    double sum, state;
+    // Number of finite values in the window of the averages
+    size_t finite;
+    // Values in the window of the median, in increasing order
+    std::vector<double> sorted;
+    std::vector<double> weights;
+    double (*advance)(SmoothingFilter &);
+  };
+
+  template <typename T>
+  static double column_value(const T *column, size_t row) {
+    return double(column[row]);
+  }
+
+  template <typename T>
+  static double column_value(const std::vector<T> &column, size_t row) {
+    return double(column[row]);
+  }
+
+  // Filters are read in order, one row at a time
+  static double column_value(SmoothingFilter &filter, size_t) {
+    return filter.next();
+  }
+
+  /* Hash table with open addressing and linear probing, used by
+     `bar_aggregate` to accumulate the values of each key */
+  template <typename K> struct AggregateTable {
+    struct Entry {
+      K key;
+      size_t hash;
+      size_t count;
+      double sum, min, max;
+    };
+
+    // Empty slots have `count == 0`; the size is a power of two
+    std::vector<Entry> slots;
+    size_t used;
+
+    AggregateTable() : slots(16), used{} {}
+
+    void add(const K &key, size_t hash, double value) {
+      Entry &entry{find(key, hash)};
+      if (entry.count == 0) {
+        entry.min = entry.max = value;
+      } else {
+        entry.min = std::min(entry.min, value);
+        entry.max = std::max(entry.max, value);
+      }
+      entry.sum += value;
+      ++entry.count;
+    }
+
+    void merge(const Entry &other) {
+      Entry &entry{find(other.key, other.hash)};
+      if (entry.count == 0) {
+        entry = other;
+      } else {
+        entry.min = std::min(entry.min, other.min);
+        entry.max = std::max(entry.max, other.max);
+        entry.sum += other.sum;
+        entry.count += other.count;
+      }
+    }
+
+  private:
+    // Return the slot of `key`, initializing it if the key is new
+    Entry &find(const K &key, size_t hash) {
+      // Keep the table at most half full
+      if (2 * (used + 1) > slots.size())
+        grow();
+
+      Entry &entry{slots[probe(slots, key, hash)]};
+      if (entry.count == 0) {
+        entry.key = key;
+        entry.hash = hash;
+        entry.sum = 0.0;
+        ++used;
+      }
+      return entry;
+    }
+
+    static size_t probe(const std::vector<Entry> &table, const K &key,
+                        size_t hash) {
+      // Multiplying by 2⁶⁴/φ spreads consecutive hashes (e.g., those of
+      // small integers) over the whole table
+      const size_t mask{table.size() - 1};
+      size_t index{size_t((std::uint64_t(hash) * 0x9E3779B97F4A7C15ULL) >> 20) &
+                   mask};
+      while (table[index].count > 0 &&
+             !(table[index].hash == hash && table[index].key == key))
+        index = (index + 1) & mask;
+      return index;
+    }
+
+    void grow() {
+      std::vector<Entry> bigger(2 * slots.size());
+      for (auto &entry : slots) {
+        if (entry.count > 0)
+          bigger[probe(bigger, entry.key, entry.hash)] = std::move(entry);
+      }
+      slots.swap(bigger);
+    }
+  };
+
+  /* Count the values falling in each of the `nbins` bins of width
+     `binwidth` starting from `min`. Value v goes in the bin
+     ⌊(v - min) / binwidth⌋, except the maximum, which goes in the last
+     one instead of a new bin. */
+  template <typename T>
+  static std::vector<size_t> count_bins(const std::vector<T> &values, T min,
+                                        T, double binwidth, size_t nbins,
+                                        std::false_type) {
+    std::vector<size_t> bins(nbins);
+    for (const auto &val : values) {
+      const size_t index{size_t((double(val) - double(min)) / binwidth)};
+      ++bins[std::min(index, nbins - 1)];
+    }
+
+    return bins;
+  }
+
+  /* Integers spanning a small range (up to 2¹⁷ values, i.e., a 1 MB
+     table, and no more than their number) are first counted one by one
+     in a dense table, which needs no floating-point operation per
+     value. The table is then rebinned applying the same rule as above:
+     the first entry of each bin is computed once, and the entries in
+     between are summed with integer arithmetic only. */
+  template <typename T>
+  static std::vector<size_t> count_bins(const std::vector<T> &values, T min,
+                                        T max, double binwidth, size_t nbins,
+                                        std::true_type) {
+    // Unsigned arithmetic cannot overflow, even for the widest ranges
+    const std::uint64_t span{std::uint64_t(max) - std::uint64_t(min)};
+    const std::uint64_t max_table_size{
+        std::min<std::uint64_t>(values.size(), std::uint64_t(1) << 17)};
+    if (span >= max_table_size)
+      return count_bins(values, min, max, binwidth, nbins, std::false_type{});
+
+    std::vector<size_t> table(span + 1);
+    for (const auto &val : values)
+      ++table[std::uint64_t(val) - std::uint64_t(min)];
+
+    auto bin_of = [binwidth](size_t offset) {
+      return size_t(double(offset) / binwidth);
+    };
+
+    std::vector<size_t> bins(nbins);
+    size_t first{};
+    for (size_t bin{}; bin < nbins && first < table.size(); ++bin) {
+      // One past the last entry of `bin`; the last bin takes the rest
+      size_t last{table.size()};
+      if (bin + 1 < nbins) {
+        const double edge{std::ceil(double(bin + 1) * binwidth)};
+        last = std::max(first, size_t(std::min(edge, double(table.size()))));
+        while (last > first && bin_of(last - 1) > bin)
+          --last;
+        while (last < table.size() && bin_of(last) <= bin)
+          ++last;
+      }
+
+      size_t count{};
+      for (size_t offset{first}; offset < last; ++offset)
+        count += table[offset];
+      bins[bin] = count;
+      first = last;
+    }
+
+    return bins;
+  }
+
+  /* Add Σ (xᵢ - meanᵢ)(xⱼ - meanⱼ) over the samples in [begin, end)
+     to `cov[i * nchannels + j]` for j ≥ i. Samples are centered in
+     blocks, and each block updates the matrix one tile at a time with
+     rank-1 updates, whose inner loop is vectorized by the compiler. */
+  template <typename T>
+  static void accumulate_covariance(const T *matrix, size_t sample_stride,
+                                    size_t channel_stride,
+                                    const std::vector<double> &mean,
+                                    size_t begin, size_t end, double *cov) {
+    constexpr size_t BLOCK{128}, TILE{64};
+    const size_t nchannels{mean.size()};
+    std::vector<double> block(BLOCK * nchannels);
+
+    for (size_t first{begin}; first < end; first += BLOCK) {
+      const size_t count{std::min(BLOCK, end - first)};
+      for (size_t k{}; k < count; ++k) {
+        const T *row{matrix + (first + k) * sample_stride};
+        double *dest{block.data() + k * nchannels};
+        for (size_t ch{}; ch < nchannels; ++ch)
+          dest[ch] = double(row[ch * channel_stride]) - mean[ch];
+      }
+
+      for (size_t i0{}; i0 < nchannels; i0 += TILE) {
+        const size_t i1{std::min(nchannels, i0 + TILE)};
+        for (size_t j0{i0}; j0 < nchannels; j0 += TILE) {
+          const size_t j1{std::min(nchannels, j0 + TILE)};
+          for (size_t k{}; k < count; ++k) {
+            const double *sample{block.data() + k * nchannels};
+            for (size_t i{i0}; i < i1; ++i) {
+              const double a{sample[i]};
+              double *dest{cov + i * nchannels};
+              for (size_t j{std::max(i, j0)}; j < j1; ++j)
+                dest[j] += a * sample[j];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  /* Add a series computed by the library, which is not affected by
+     `set_smoothing` */
+  void plot_points(const std::vector<double> &x, const std::vector<double> &y,
+                   const std::string &label, LineStyle style) {
+    const Smoothing saved{smoothing};
+    smoothing = Smoothing{};
+    plot(x, y, label, style);
+    smoothing = saved;
+  }
+
+  /* Map a double to an integer so that the order of the integers is
+     the same as the order of the numbers: negative numbers have all
+     their bits flipped, positive numbers just the sign bit */
+  static std::uint64_t sortable_key(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const std::uint64_t sign{std::uint64_t(1) << 63};
+    return (bits & sign) ? ~bits : (bits | sign);
+  }
+
+  static double key_value(std::uint64_t key) {
+    const std::uint64_t sign{std::uint64_t(1) << 63};
+    const std::uint64_t bits{(key & sign) ? (key & ~sign) : ~key};
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  /* Parallel LSD radix sort, 11 bits at a time. Each thread counts the
+     digits in its part of the array, and then moves its elements to
+     the positions computed from the counts of all the threads. Passes
+     where all the keys have the same digit are skipped. */
+  static void radix_sort(std::vector<std::uint64_t> &keys) {
+    constexpr int BITS{11};
+    constexpr size_t RADIX{size_t(1) << BITS};
+
+    const size_t n{keys.size()};
+    const size_t nchunks{num_chunks(n)};
+    std::vector<std::uint64_t> buffer(n);
+    std::vector<size_t> offsets(nchunks * RADIX);
+
+    for (int shift{}; shift < 64; shift += BITS) {
+      std::fill(offsets.begin(), offsets.end(), 0);
+      parallel_chunks(n, nchunks, [&](size_t c, size_t begin, size_t end) {
+        size_t *counts{offsets.data() + c * RADIX};
+        for (size_t i{begin}; i < end; ++i)
+          ++counts[(keys[i] >> shift) & (RADIX - 1)];
+      });
+
+      size_t position{};
+      bool trivial{false};
+      for (size_t digit{}; digit < RADIX; ++digit) {
+        size_t total{};
+        for (size_t c{}; c < nchunks; ++c) {
+          const size_t count{offsets[c * RADIX + digit]};
+          offsets[c * RADIX + digit] = position;
+          position += count;
+          total += count;
+        }
+        trivial = trivial || total == n;
+      }
+      if (trivial)
+        continue;
+
+      parallel_chunks(n, nchunks, [&](size_t c, size_t begin, size_t end) {
+        size_t *next{offsets.data() + c * RADIX};
+        for (size_t i{begin}; i < end; ++i)
+          buffer[next[(keys[i] >> shift) & (RADIX - 1)]++] = keys[i];
+      });
+      keys.swap(buffer);
+    }
+  }
+
+  /* Radix-2 fast Fourier transform of a fixed size, whose tables can
+     be shared by several threads. Complex numbers are split in their
+     real and imaginary parts. */
+  class FourierTransform {
+  public:
+    explicit FourierTransform(size_t size)
+        : n{size}, reversed(size), twiddle_re(size / 2), twiddle_im(size / 2) {
+      size_t bits{};
+      while ((size_t(1) << bits) < n)
+        ++bits;
+
+      for (size_t i{}; i < n; ++i) {
+        size_t r{};
+        for (size_t b{}; b < bits; ++b)
+          r |= ((i >> b) & 1) << (bits - 1 - b);
+        reversed[i] = r;
+      }
+
+      const double pi{std::acos(-1.0)};
+      for (size_t k{}; k < n / 2; ++k) {
+        twiddle_re[k] = std::cos(-2 * pi * k / n);
+        twiddle_im[k] = std::sin(-2 * pi * k / n);
+      }
+    }
+
+    // In-place forward transform of the `n` values re[k] + i·im[k]
+    void transform(std::vector<double> &re, std::vector<double> &im) const {
+      assert(re.size() == n && im.size() == n);
+
+      for (size_t i{}; i < n; ++i) {
+        if (i < reversed[i]) {
+          std::swap(re[i], re[reversed[i]]);
+          std::swap(im[i], im[reversed[i]]);
+        }
+      }
+
+      for (size_t len{2}; len <= n; len *= 2) {
+        const size_t step{n / len};
+        for (size_t start{}; start < n; start += len) {
+          for (size_t k{}; k < len / 2; ++k) {
+            const size_t a{start + k}, b{start + k + len / 2};
+            const double wr{twiddle_re[k * step]}, wi{twiddle_im[k * step]};
+            const double tr{wr * re[b] - wi * im[b]};
+            const double ti{wr * im[b] + wi * re[b]};
+            re[b] = re[a] - tr;
+            im[b] = im[a] - ti;
+            re[a] += tr;
+            im[a] += ti;
+          }
+        }
+      }
+    }
+
+  private:
+    size_t n;
+    std::vector<size_t> reversed;
+    std::vector<double> twiddle_re, twiddle_im;
+  };
+
+  /* Sums of the powers of u = x - shift needed by the normal equations
+     of a polynomial fit: x[k] = Σ uᵏ for k = 0…2·degree, and
+     xy[k] = Σ uᵏ y for k = 0…degree */
+  struct PowerSums {
+    std::vector<double> x, xy;
+    double min, max;
+
+    explicit PowerSums(int degree)
+        : x(2 * degree + 1), xy(degree + 1), min{INFINITY}, max{-INFINITY} {}
+
+    template <typename T, typename U>
+    void add(const T *xs, const U *ys, size_t count, double shift) {
+      // Points are processed in blocks, and each block is summed into
+      // LANES independent accumulators: the compiler may not reorder
+      // floating-point additions, so a single sum would be a chain of
+      // dependent additions that cannot be vectorized
+      constexpr size_t BLOCK{256}, LANES{4};
+      double u[BLOCK], y[BLOCK], power[BLOCK];
+
+      for (size_t first{}; first < count; first += BLOCK) {
+        const size_t n{std::min(BLOCK, count - first)};
+        for (size_t i{}; i < n; ++i) {
+          u[i] = double(xs[first + i]) - shift;
+          y[i] = double(ys[first + i]);
+          power[i] = 1.0;
+          min = std::min(min, u[i] + shift);
+          max = std::max(max, u[i] + shift);
+        }
+
+        for (size_t k{}; k < x.size(); ++k) {
+          double sum_x[LANES]{}, sum_xy[LANES]{};
+          size_t i{};
+          for (; i + LANES <= n; i += LANES) {
+            for (size_t lane{}; lane < LANES; ++lane) {
+              sum_x[lane] += power[i + lane];
+              sum_xy[lane] += power[i + lane] * y[i + lane];
+              power[i + lane] *= u[i + lane];
+            }
+          }
+          for (; i < n; ++i) {
+            sum_x[0] += power[i];
+            sum_xy[0] += power[i] * y[i];
+            power[i] *= u[i];
+          }
+
+          x[k] += (sum_x[0] + sum_x[1]) + (sum_x[2] + sum_x[3]);
+          if (k < xy.size())
+            xy[k] += (sum_xy[0] + sum_xy[1]) + (sum_xy[2] + sum_xy[3]);
+        }
+      }
+    }
+
+    void merge(const PowerSums &other) {
+      for (size_t k{}; k < x.size(); ++k)
+        x[k] += other.x[k];
+      for (size_t k{}; k < xy.size(); ++k)
+        xy[k] += other.xy[k];
+      min = std::min(min, other.min);
+      max = std::max(max, other.max);
+    }
+  };
+
+  /* Solve the n×n system a·x = b using Gaussian elimination with
+     partial pivoting, saving the solution in `b`. Return `false` if
+     the matrix is singular. */
+  static bool solve_linear_system(std::vector<double> &a,
+                                  std::vector<double> &b) {
+    const size_t n{b.size()};
+    for (size_t col{}; col < n; ++col) {
+      size_t pivot{col};
+      for (size_t row{col + 1}; row < n; ++row) {
+        if (std::fabs(a[row * n + col]) > std::fabs(a[pivot * n + col]))
+          pivot = row;
+      }
+
+      if (!(std::fabs(a[pivot * n + col]) > 1e-12))
+        return false;
+
+      if (pivot != col) {
+        for (size_t k{}; k < n; ++k)
+          std::swap(a[col * n + k], a[pivot * n + k]);
+        std::swap(b[col], b[pivot]);
+      }
+
+      for (size_t row{col + 1}; row < n; ++row) {
+        const double factor{a[row * n + col] / a[col * n + col]};
+        for (size_t k{col}; k < n; ++k)
+          a[row * n + k] -= factor * a[col * n + k];
+        b[row] -= factor * b[col];
+      }
+    }
+
+    for (size_t row{n}; row-- > 0;) {
+      for (size_t k{row + 1}; k < n; ++k)
+        b[row] -= a[row * n + k] * b[k];
+      b[row] /= a[row * n + row];
+    }
+
+    return true;
+  }
+
+  // Number of threads used to process `n` elements
+  static size_t num_chunks(size_t n) {
+    const size_t min_chunk_size{65536};
+    const size_t num_cpus{std::max(1u, std::thread::hardware_concurrency())};
+    return std::max<size_t>(1, std::min(num_cpus, n / min_chunk_size));
+  }
+
+  /* Split [0, n) in `nchunks` contiguous ranges and call
+     `func(chunk, begin, end)` for each of them, each on its own thread */
+  template <typename F>
+  static void parallel_chunks(size_t n, size_t nchunks, F func) {
+    std::vector<std::thread> threads;
+    for (size_t c{1}; c < nchunks; ++c)
+      threads.emplace_back(func, c, n * c / nchunks, n * (c + 1) / nchunks);
+
+    func(size_t{}, size_t{}, n / nchunks);
+    for (auto &t : threads)
+      t.join();
+  }
+
+  // Write a row-major matrix in a data file, one row per line
+  template <typename T>
+  static void write_rows(std::ostream &os, const T *matrix, size_t nrows,
+                         size_t ncols) {
+    for (size_t row{}; row < nrows; ++row) {
+      const T *values{matrix + row * ncols};
+      for (size_t col{}; col < ncols; ++col) {
+        if (col > 0)
+          os << " ";
+        os << values[col];
+      }
+      os << "\n";
+    }
+  }
+
+  /* Copy rows `first`…`first + count - 1` of a column-major matrix
+     into `dest` using a row-major layout. The copy proceeds in small
+     tiles so that both the source and the destination stay in the
+     cache even when there are thousands of columns. */
+  template <typename T>
+  static void transpose_block(const T *src, size_t nrows, size_t ncols,
+                              size_t first, size_t count, T *dest) {
+    const size_t tile{32};
+    for (size_t r0{}; r0 < count; r0 += tile) {
+      const size_t r1{std::min(count, r0 + tile)};
+      for (size_t c0{}; c0 < ncols; c0 += tile) {
+        const size_t c1{std::min(ncols, c0 + tile)};
+        for (size_t c{c0}; c < c1; ++c) {
+          const T *column{src + c * nrows + first};
+          for (size_t r{r0}; r < r1; ++r)
+            dest[r * ncols + c] = column[r];
+        }
+      }
+    }
+  }
+
+  std::string style_to_str(LineStyle style) {
+    switch (style) {
+    case LineStyle::DOTS:
+      return "dots";
+    case LineStyle::POINTS:
+      return "points";
+    case LineStyle::LINESPOINTS:
+      return "linespoints";
+    case LineStyle::STEPS:
+      return "steps";
+    case LineStyle::BOXES:
+      return "boxes";
+    case LineStyle::IMAGE:
+      return "image";
+    default:
+      return "lines";
+    }
+  }
+
+  /* Return the `binary` clause for a data file with `ncols` columns,
+     or an empty string if data are written as text */
+  std::string binary_format(size_t ncols) const {
+    if (transport != DataTransport::BINARY)
+      return "";
+
+    std::string result{"binary format='"};
+    for (size_t i{}; i < ncols; ++i)
+      result += "%float64";
+    return result + "'";
+  }
+
+  /* Write `nrows` rows of doubles taking the elements of each row from
+     the columns; this is what Gnuplot reads with `binary_format` */
+  template <typename... C>
+  static void write_binary(const std::string &filename, size_t nrows,
+                           C &&...columns) {
+    std::ofstream of{filename, std::ios::binary};
+    assert(of.good());
+
+    constexpr size_t ncols{sizeof...(C)};
+    std::vector<double> buffer;
+    buffer.reserve(std::min<size_t>(nrows, 8192) * ncols);
+    for (size_t row{}; row < nrows; ++row) {
+      for (double value : {column_value(columns, row)...})
+        buffer.push_back(value);
+
+      if (buffer.size() >= 8192 * ncols || row + 1 == nrows) {
+        of.write(reinterpret_cast<const char *>(buffer.data()),
+                 buffer.size() * sizeof(double));
+        buffer.clear();
+      }
+    }
+  }
+
+  /* Return `preferred` unless the Gnuplot executable is known to lack
+     it and to support `fallback`. Only the first word is checked.
+     Objects created with `LazyStart` query Gnuplot only when they
+     start it, so they return `preferred` and check it then. */
+  std::string available_terminal(const std::string &preferred,
+                                 const std::string &fallback) {
+    auto name = [](const std::string &t) { return t.substr(0, t.find(' ')); };
+    if (lazy_start)
+      unchecked_terminal = std::make_pair(preferred, fallback);
+
+    if (!capabilities.probed || capabilities.has_terminal(name(preferred)) ||
+        !capabilities.has_terminal(name(fallback)))
+      return preferred;
+
+    return fallback;
+  }
+
+  /* Choose who draws the next plots. The native renderer is only
+     reached through a pointer set here, so that it is only compiled
+     in the files calling `redirect_to_svg` or `redirect_to_thumbnail`. */
+  void use_renderer(Renderer r) {
+    native_renderer = r == Renderer::NATIVE ? &Gnuplot::render_native
+                                            : nullptr;
+  }
+
+  /* Set the terminal and the output file. Objects created with
+     `LazyStart` send them when Gnuplot starts, so that redirecting
+     the output again replaces them. */
+  bool send_terminal_commands(const std::string &commands) {
+    terminal_commands = commands;
+    if (!lazy_start)
+      return sendcommand(commands);
+
+    if (recording)
+      recording->command(commands.c_str());
+    return true;
+  }
+
+  /* Number of points to use when sampling a curve: one per pixel of
+     the PNG image, or a reasonable guess for other terminals */
+  size_t display_samples() const {
+    int width{}, height{};
+    if (current_terminal.compare(0, 3, "png") == 0 &&
+        std::sscanf(png_size.c_str(), "%d,%d", &width, &height) == 2 &&
+        width > 1)
+      return size_t(width);
+
+    return 1000;
+  }
+
+  // Return true if a "width,height" size is small enough to be a thumbnail
+  static bool is_thumbnail_size(const std::string &size) {
+    int width{}, height{};
+    if (std::sscanf(size.c_str(), "%d,%d", &width, &height) != 2)
+      return false;
+
+    return width <= 320 && height <= 240;
+  }
+
+  /* Geometry of a plot drawn by `render_native`: the plot area, in
+     pixels from the top-left corner of the image, and the ranges */
+  struct NativeFigure {
+    int width, height;
+    double left, top, right, bottom;
+    double xmin, xmax, ymin, ymax;
+    std::vector<double> xtics, ytics;
+    std::string xlabel, ylabel;
+    // False for thumbnails, which only show the curves
+    bool decorations;
+
+    double to_px(double x) const {
+      return left + (x - xmin) / (xmax - xmin) * (right - left);
+    }
+
+    double to_py(double y) const {
+      return bottom - (y - ymin) / (ymax - ymin) * (bottom - top);
+    }
+  };
+
+  /* Choose the tics of an axis so that about `max_tics` of them fit,
+     extending the automatic ends of the range to the closest tic as
+     Gnuplot does */
+  static std::vector<double> native_tics(double &min, double &max,
+                                         bool auto_min, bool auto_max,
+                                         double max_tics) {
+    if (!(max > min)) {
+      const double delta{min == 0 ? 1.0 : std::fabs(min) * 0.1};
+      min -= delta;
+      max += delta;
+    }
+
+    const double raw{(max - min) / std::max(1.0, max_tics)};
+    const double magnitude{std::pow(10.0, std::floor(std::log10(raw)))};
+    const double norm{raw / magnitude};
+    const double step{(norm <= 1 ? 1 : norm <= 2 ? 2 : norm <= 5 ? 5 : 10) *
+                      magnitude};
+
+    if (auto_min)
+      min = std::floor(min / step + 1e-9) * step;
+    if (auto_max)
+      max = std::ceil(max / step - 1e-9) * step;
+
+    std::vector<double> tics;
+    for (double i{std::ceil(min / step - 1e-9)}; i * step <= max + step * 1e-9;
+         ++i)
+      tics.push_back(i * step + 0.0); // Turn -0 into 0
+    return tics;
+  }
+
+  static std::string format_tic(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%g", value);
+    return buffer;
+  }
+
+  /* Compute the ranges, the tics and the plot area of the series, which
+     must all be kept in memory. Return `false` if nothing can be
+     drawn. */
+  bool layout_native(NativeFigure &fig) const {
+    if (std::sscanf(native_size.c_str(), "%d,%d", &fig.width, &fig.height) !=
+            2 ||
+        fig.width < 2 || fig.height < 2)
+      return false;
+
+    double xmin{INFINITY}, xmax{-INFINITY}, ymin{INFINITY}, ymax{-INFINITY};
+    const bool auto_x{std::sscanf(xrange.c_str(), "[%lf:%lf]", &xmin,
+                                  &xmax) != 2};
+    const bool auto_y{std::sscanf(yrange.c_str(), "[%lf:%lf]", &ymin,
+                                  &ymax) != 2};
+
+    // Like Gnuplot, points outside a fixed X range do not count when
+    // computing the Y range. Boxes always start from zero.
+    for (const auto &s : series) {
+      const bool boxes{s.line_style == LineStyle::BOXES};
+      for (size_t i{}; i < s.y.size(); ++i) {
+        const double x{s.x.empty() ? double(i) : s.x[i]}, y{s.y[i]};
+        if (!std::isfinite(x) || !std::isfinite(y))
+          continue;
+
+        double left{x}, right{x};
+        if (boxes)
+          box_edges(s, i, left, right);
+
+        if (auto_x) {
+          xmin = std::min(xmin, left);
+          xmax = std::max(xmax, right);
+        } else if (x < std::min(xmin, xmax) || x > std::max(xmin, xmax)) {
+          continue;
+        }
+
+        if (auto_y) {
+          ymin = std::min(ymin, boxes ? std::min(y, 0.0) : y);
+          ymax = std::max(ymax, boxes ? std::max(y, 0.0) : y);
+        }
+      }
+    }
+    // Reversed axes are left to Gnuplot
+    if (!(xmin <= xmax) || !(ymin <= ymax))
+      return false;
+
+    fig.decorations = current_terminal == "svg" &&
+                      !is_thumbnail_size(native_size);
+    if (!fig.decorations) {
+      fig.left = fig.top = 0;
+      fig.right = fig.width;
+      fig.bottom = fig.height;
+      native_tics(xmin, xmax, false, false, 1);
+      native_tics(ymin, ymax, false, false, 1);
+    } else {
+      // Text is 12 pixels high, and about 7 pixels wide per character
+      fig.top = 10;
+      fig.bottom = fig.height - (fig.xlabel.empty() ? 22 : 40);
+      fig.ytics = native_tics(ymin, ymax, auto_y, auto_y,
+                              (fig.bottom - fig.top) / 40);
+
+      size_t max_chars{1};
+      for (double tic : fig.ytics)
+        max_chars = std::max(max_chars, format_tic(tic).size());
+      fig.left = 12 + 7.0 * max_chars + (fig.ylabel.empty() ? 0 : 18);
+      fig.right = fig.width - 15;
+      fig.xtics = native_tics(xmin, xmax, auto_x, auto_x,
+                              (fig.right - fig.left) / 80);
+    }
+
+    fig.xmin = xmin;
+    fig.xmax = xmax;
+    fig.ymin = ymin;
+    fig.ymax = ymax;
+    return fig.right > fig.left && fig.bottom > fig.top;
+  }
+
+  /* Edges of box `i` of a series plotted with boxes: like Gnuplot,
+     each box extends halfway to its neighbors */
+  static void box_edges(const GnuplotSeries &s, size_t i, double &left,
+                        double &right) {
+    auto x = [&s](size_t k) { return s.x.empty() ? double(k) : s.x[k]; };
+    const size_t n{s.y.size()};
+    const double center{x(i)};
+
+    if (n == 1) {
+      left = center - 0.5;
+      right = center + 0.5;
+      return;
+    }
+
+    left = i > 0 ? (x(i - 1) + center) / 2 : center - (x(1) - center) / 2;
+    right = i + 1 < n ? (center + x(i + 1)) / 2
+                      : center + (center - x(n - 2)) / 2;
+    if (!std::isfinite(left))
+      left = center - 0.5;
+    if (!std::isfinite(right))
+      right = center + 0.5;
+  }
+
+  /* Pixel coordinates of the points of a series kept in memory. For
+     lines, each run of consecutive points falling in the same pixel
+     column is reduced to its first, lowest, highest and last point,
+     which draw the same pixels; for markers, only the first point
+     falling in each pixel is kept. Pieces of a line broken by
+     undefined values are separated by a NaN pair, and steps are
+     turned into lines with two points per step. */
+  static void native_points(const NativeFigure &fig, const GnuplotSeries &s,
+                            bool markers, std::vector<double> &out) {
+    out.clear();
+
+    const bool steps{!markers && s.line_style == LineStyle::STEPS};
+    const size_t count{steps ? 2 * s.y.size() - 1 : s.y.size()};
+    auto point = [&](size_t i, double &px, double &py) {
+      // Point 2k + 1 of a step is at the x of point k + 1 and the y of
+      // point k
+      const size_t xi{steps ? (i + 1) / 2 : i}, yi{steps ? i / 2 : i};
+      const double x{s.x.empty() ? double(xi) : s.x[xi]}, y{s.y[yi]};
+      if (!std::isfinite(x) || !std::isfinite(y))
+        return false;
+
+      // Keep the numbers small, as the plot area clips them anyway
+      px = std::max(-1e6, std::min(1e6, fig.to_px(x)));
+      py = std::max(-1e6, std::min(1e6, fig.to_py(y)));
+      return true;
+    };
+
+    if (markers) {
+      std::vector<bool> used(size_t(fig.width) * fig.height);
+      for (size_t i{}; i < s.y.size(); ++i) {
+        double px, py;
+        if (!point(i, px, py) || px < fig.left || px > fig.right ||
+            py < fig.top || py > fig.bottom)
+          continue;
+
+        const size_t col{std::min(size_t(px), size_t(fig.width - 1))};
+        const size_t row{std::min(size_t(py), size_t(fig.height - 1))};
+        if (used[row * fig.width + col])
+          continue;
+
+        used[row * fig.width + col] = true;
+        out.push_back(px);
+        out.push_back(py);
+      }
+      return;
+    }
+
+    size_t run[4]; // First, lowest, highest and last point of the run
+    double low{}, high{}, column{NAN};
+    auto flush = [&]() {
+      if (std::isnan(column))
+        return;
+
+      std::sort(run, run + 4);
+      for (size_t k{}; k < 4; ++k) {
+        double px, py;
+        if ((k == 0 || run[k] != run[k - 1]) && point(run[k], px, py)) {
+          out.push_back(px);
+          out.push_back(py);
+        }
+      }
+      column = NAN;
+    };
+
+    for (size_t i{}; i < count; ++i) {
+      double px, py;
+      if (!point(i, px, py)) {
+        flush();
+        if (!out.empty() && !std::isnan(out.back())) {
+          out.push_back(NAN);
+          out.push_back(NAN);
+        }
+        continue;
+      }
+
+      if (std::floor(px) == column) {
+        if (py < low) {
+          low = py;
+          run[1] = i;
+        }
+        if (py > high) {
+          high = py;
+          run[2] = i;
+        }
+        run[3] = i;
+      } else {
+        flush();
+        column = std::floor(px);
+        low = high = py;
+        run[0] = run[1] = run[2] = run[3] = i;
+      }
+    }
+    flush();
+  }
+
+  // Append a pixel coordinate with one decimal digit
+  static void append_pixel(std::string &out, double value) {
+    long tenths{std::lround(value * 10)};
+    if (tenths < 0) {
+      out.push_back('-');
+      tenths = -tenths;
+    }
+
+    char digits[24];
+    int ndigits{};
+    long integer{tenths / 10};
+    do {
+      digits[ndigits++] = char('0' + integer % 10);
+      integer /= 10;
+    } while (integer > 0);
+    while (ndigits > 0)
+      out.push_back(digits[--ndigits]);
+
+    if (tenths % 10 != 0) {
+      out.push_back('.');
+      out.push_back(char('0' + tenths % 10));
+    }
+  }
+
+  /* Append text escaped for XML; if `number` is true, minus signs are
+     written like "set minussign" does */
+  static void append_xml(std::string &out, const std::string &text,
+                         bool number = false) {
+    for (char c : text) {
+      switch (c) {
+      case '<':
+        out += "&lt;";
+        break;
+      case '>':
+        out += "&gt;";
+        break;
+      case '&':
+        out += "&amp;";
+        break;
+      case '"':
+        out += "&quot;";
+        break;
+      case '-':
+        out += number ? "&#8722;" : "-";
+        break;
+      default:
+        out.push_back(c);
+      }
+    }
+  }
+
+  // Colors of the first lines in Gnuplot's default palette
+  static const char *native_color(size_t index) {
+    static const char *colors[]{"#9400d3", "#009e73", "#56b4e9", "#e69f00",
+                                "#f0e442", "#0072b2", "#e51e10", "#000000"};
+    return colors[index % 8];
+  }
+
+  /* Return true if `line` is one of the lines in `text` */
+  static bool has_line(const std::string &text, const std::string &line) {
+    return ("\n" + text + "\n").find("\n" + line + "\n") != std::string::npos;
+  }
+
+  /* If `line` is `prefix` followed by a string quoted with
+     `escape_quotes`, save the string in `result` */
+  static bool unquote_argument(const std::string &line,
+                               const std::string &prefix,
+                               std::string &result) {
+    if (line.size() < prefix.size() + 2 ||
+        line.compare(0, prefix.size(), prefix) != 0 ||
+        line[prefix.size()] != '\'' || line.back() != '\'')
+      return false;
+
+    result.clear();
+    for (size_t i{prefix.size() + 1}; i + 1 < line.size(); ++i) {
+      result.push_back(line[i]);
+      if (line[i] == '\'')
+        ++i;
+    }
+    return true;
+  }
+
+  /* Draw a line in an image with one byte per pixel, clipping it to
+     the image first */
+  static void draw_line(std::vector<unsigned char> &pixels, int width,
+                        int height, double x0, double y0, double x1,
+                        double y1, unsigned char color) {
+    // Liang-Barsky clipping
+    const double dx{x1 - x0}, dy{y1 - y0};
+    const double p[4]{-dx, dx, -dy, dy};
+    const double q[4]{x0, width - 1 - x0, y0, height - 1 - y0};
+    double t0{0.0}, t1{1.0};
+    for (int k{}; k < 4; ++k) {
+      if (p[k] == 0) {
+        if (q[k] < 0)
+          return;
+        continue;
+      }
+
+      const double t{q[k] / p[k]};
+      if (p[k] < 0)
+        t0 = std::max(t0, t);
+      else
+        t1 = std::min(t1, t);
+    }
+    if (t0 > t1)
+      return;
+
+    auto pixel = [](double value, int size) {
+      return int(std::max(0L, std::min(long(size - 1), std::lround(value))));
+    };
+    int ax{pixel(x0 + t0 * dx, width)}, ay{pixel(y0 + t0 * dy, height)};
+    const int bx{pixel(x0 + t1 * dx, width)}, by{pixel(y0 + t1 * dy, height)};
+
+    // Bresenham's algorithm
+    const int sx{ax < bx ? 1 : -1}, sy{ay < by ? 1 : -1};
+    const int ddx{std::abs(bx - ax)}, ddy{-std::abs(by - ay)};
+    int err{ddx + ddy};
+    while (true) {
+      pixels[size_t(ay) * width + ax] = color;
+      if (ax == bx && ay == by)
+        break;
+
+      const int e2{2 * err};
+      if (e2 >= ddy) {
+        err += ddy;
+        ax += sx;
+      }
+      if (e2 <= ddx) {
+        err += ddx;
+        ay += sy;
+      }
+    }
+  }
+
+  static std::uint32_t png_crc(const std::string &data) {
+    static const std::vector<std::uint32_t> table = [] {
+      std::vector<std::uint32_t> result(256);
+      for (std::uint32_t n{}; n < 256; ++n) {
+        std::uint32_t c{n};
+        for (int k{}; k < 8; ++k)
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        result[n] = c;
+      }
+      return result;
+    }();
+
+    std::uint32_t crc{0xffffffffu};
+    for (char c : data)
+      crc = table[(crc ^ (unsigned char)c) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+  }
+
+  static void append_be32(std::string &out, std::uint32_t value) {
+    for (int shift{24}; shift >= 0; shift -= 8)
+      out.push_back(char((value >> shift) & 0xff));
+  }
+
+  /* Compress data in a zlib stream using the fixed Huffman codes of
+     deflate. Runs of the same byte, which make up most of a plot, are
+     encoded as copies of the previous byte. */
+  static std::string zlib_compress(const std::string &data) {
+    std::string out{"\x78\x01"};
+    std::uint32_t bits{};
+    int nbits{};
+
+    auto put = [&](std::uint32_t value, int count) {
+      bits |= value << nbits;
+      nbits += count;
+      while (nbits >= 8) {
+        out.push_back(char(bits & 0xff));
+        bits >>= 8;
+        nbits -= 8;
+      }
+    };
+    // Huffman codes start from their most significant bit
+    auto put_code = [&](std::uint32_t code, int count) {
+      std::uint32_t reversed{};
+      for (int i{}; i < count; ++i)
+        reversed |= ((code >> i) & 1) << (count - 1 - i);
+      put(reversed, count);
+    };
+    auto put_symbol = [&](unsigned symbol) {
+      if (symbol < 144)
+        put_code(0x30 + symbol, 8);
+      else if (symbol < 256)
+        put_code(0x190 + symbol - 144, 9);
+      else if (symbol < 280)
+        put_code(symbol - 256, 7);
+      else
+        put_code(0xc0 + symbol - 280, 8);
+    };
+
+    static const unsigned length_base[]{
+        3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int length_extra[]{0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                    1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                    4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+    // A single final block with fixed codes
+    put(1, 1);
+    put(1, 2);
+    for (size_t i{}; i < data.size();) {
+      size_t run{};
+      while (i > 0 && run < 258 && i + run < data.size() &&
+             data[i + run] == data[i - 1])
+        ++run;
+
+      if (run < 3) {
+        put_symbol((unsigned char)data[i++]);
+        continue;
+      }
+
+      int code{28};
+      while (length_base[code] > run)
+        --code;
+      put_symbol(257 + code);
+      put(std::uint32_t(run - length_base[code]), length_extra[code]);
+      put_code(0, 5); // Distance 1
+      i += run;
+    }
+    put_symbol(256);
+    if (nbits > 0)
+      put(0, 8 - nbits);
+
+    std::uint32_t a{1}, b{};
+    for (char c : data) {
+      a = (a + (unsigned char)c) % 65521;
+      b = (b + a) % 65521;
+    }
+    append_be32(out, (b << 16) | a);
+    return out;
+  }
+
+  static void append_png_chunk(std::string &png, const char *type,
+                               const std::string &data) {
+    const std::string chunk{type + data};
+    append_be32(png, std::uint32_t(data.size()));
+    png += chunk;
+    append_be32(png, png_crc(chunk));
+  }
+
+  bool render_native();
+  bool write_native_svg(const NativeFigure &fig);
+  bool write_native_png(const NativeFigure &fig);
+
+  std::string format_range(double min = NAN, double max = NAN) {
+    if (std::isnan(min) || std::isnan(max))
+      return "[]";
+
+    std::stringstream os;
+    os << "[" << min << ":" << max << "]";
+
+    return os.str();
+  }
+
+  FILE *connection;
+  // PID of the Gnuplot process, if known
+  long child_pid;
+  std::vector<GnuplotSeries> series;
+  std::vector<SharedTable> shared_tables;
+  std::vector<std::string> files_to_delete;
+  std::string xrange;
+  std::string yrange;
+  std::string zrange;
+  bool is_3dplot;
+  std::string executable;
+  // Terminal and size used by the last call to `redirect_to_png`
+  std::string png_terminal;
+  std::string png_size;
+  // Name of the terminal used for the plots
+  std::string current_terminal;
+  std::unique_ptr<ParallelMultiplot> panels;
+  // True if the commands are sent to a render daemon
+  bool daemon_client;
+  const DaemonLink *daemon_link;
+  // Used to connect again to the daemon after `wait_until_rendered`
+  std::string daemon_path;
+  bool replay_settings;
+  // Shared memory files not yet passed to the render daemon
+  std::vector<int> memfds_to_pass;
+  // Named pipe used by `wait_until_rendered`, and its two ends
+  std::string ack_fifo;
+  int ack_fds[2];
+  unsigned num_acks;
+  // Number of the last acknowledgement read, and the one being read
+  unsigned acks_received;
+  std::string ack_line;
+  // Used by `start_recording`
+  std::unique_ptr<Recorder> recording;
+  // Number of elements in `series` already copied by the recording
+  size_t recorded_series;
+  // Used by `latency_stats`
+  GnuplotLatencyStats stats;
+  std::chrono::steady_clock::time_point last_show_time;
+  size_t last_show_points;
+  // Used by `last_render_stats` and `set_memory_budget`
+  RenderStats render_stats;
+  double render_cpu_start;
+  bool measuring_render;
+  size_t memory_budget_kb;
+  // Used to restart Gnuplot after a failure
+  std::string process_command;
+  std::string init_commands;
+  std::string terminal_commands;
+  double write_timeout;
+  double render_timeout;
+  std::string error_message;
+  unsigned restarts;
+  // Last command changing each setting, replayed by `restart_process`
+  std::vector<std::pair<std::string, std::string>> settings;
+  // Used by `submit_frame`: the frame being written (`frame_offset`
+  // bytes have already been sent), the one waiting to be sent and its
+  // number of points, and the acknowledgement of the last frame sent
+  Backpressure backpressure;
+  std::string frame_in_progress;
+  size_t frame_offset;
+  std::string queued_frame;
+  size_t queued_frame_points;
+  unsigned frame_ack;
+  FrameStats frames;
+  // What the Gnuplot executable can do (nothing is known about the
+  // Gnuplot processes used by a render daemon)
+  Capabilities capabilities;
+  DataTransport transport;
+  Smoothing smoothing;
+  SmoothingFilter::Start smoothing_start;
+  HistogramBins histogram_bins;
+  // Commands sent before the next plot and undone after it
+  std::string plot_settings;
+  std::string plot_cleanup;
+  // Used by `LazyStart`: true until Gnuplot is started, and the
+  // commands it must execute first
+  bool lazy_start;
+  std::string deferred_commands;
+  // Terminal chosen by `available_terminal` before Gnuplot was probed,
+  // and its fallback
+  std::pair<std::string, std::string> unchecked_terminal;
+  // True if `set_data_transport` was called
+  bool transport_set;
+  // Used by `redirect_to_svg`: `render_native`, if it may draw the
+  // plots, or null
+  bool (Gnuplot::*native_renderer)();
+  std::string native_output;
+  std::string native_size;
+};
+
+/* Compiled mode: define GNUPLOTPP_COMPILED when compiling every file
+   of your program, and GNUPLOTPP_IMPLEMENTATION too in exactly one of
+   them. The members below and the most common instantiations of the
+   templates are then compiled only once, instead of once per file. */
+#if defined(GNUPLOTPP_COMPILED) && defined(GNUPLOTPP_IMPLEMENTATION)
+#define GNUPLOTPP_INLINE
+#elif !defined(GNUPLOTPP_COMPILED)
+#define GNUPLOTPP_INLINE inline
+#endif
+
+#if defined(GNUPLOTPP_IMPLEMENTATION) || !defined(GNUPLOTPP_COMPILED)
+
+GNUPLOTPP_INLINE Gnuplot::Gnuplot(const char *executable_name, bool persist)
+    : connection{}, child_pid{-1}, series{}, shared_tables{},
+      files_to_delete{}, is_3dplot{false}, executable{executable_name},
+      png_terminal{"pngcairo color enhanced"}, png_size{"800,600"},
+      current_terminal{"default"}, panels{}, daemon_client{false},
+      daemon_link{}, daemon_path{}, replay_settings{false}, memfds_to_pass{},
+      ack_fifo{}, ack_fds{-1, -1}, num_acks{},
+      acks_received{}, ack_line{},
+      recording{}, recorded_series{},
+      stats{}, last_show_time{}, last_show_points{}, render_stats{},
+      render_cpu_start{}, measuring_render{false}, memory_budget_kb{},
+      process_command{}, init_commands{"set encoding utf8\nset minussign"},
+      terminal_commands{}, write_timeout{-1.0}, render_timeout{-1.0},
+      error_message{}, restarts{}, settings{},
+      backpressure{Backpressure::BLOCK},
+      frame_in_progress{}, frame_offset{}, queued_frame{},
+      queued_frame_points{}, frame_ack{}, frames{},
+      capabilities{probe_capabilities(executable_name)},
+      transport{capabilities.supports_binary_data() ? DataTransport::BINARY
+                                                    : DataTransport::TEXT},
+      smoothing{}, smoothing_start{}, histogram_bins{}, plot_settings{},
+      plot_cleanup{}, lazy_start{false}, deferred_commands{},
+      unchecked_terminal{}, transport_set{false}, native_renderer{},
+      native_output{}, native_size{} {
+  std::stringstream os;
+  // The --persist flag lets Gnuplot keep running after the C++
+  // program has completed its execution
+  os << executable_name;
+  if (persist)
+    os << " --persist";
+  start_process(os.str());
+
+  initialize();
+}
+
+GNUPLOTPP_INLINE Gnuplot::Gnuplot(const DaemonSocket &daemon)
+    : connection{}, child_pid{-1}, series{}, shared_tables{},
+      files_to_delete{}, is_3dplot{false}, executable{"gnuplot"},
+      png_terminal{"pngcairo color enhanced"}, png_size{"800,600"},
+      current_terminal{"default"}, panels{}, daemon_client{true}, daemon_link{},
+      daemon_path{daemon.path}, replay_settings{false}, memfds_to_pass{},
+      ack_fifo{}, ack_fds{-1, -1}, num_acks{},
+      acks_received{}, ack_line{},
+      recording{}, recorded_series{},
+      stats{}, last_show_time{}, last_show_points{}, render_stats{},
+      render_cpu_start{}, measuring_render{false}, memory_budget_kb{},
+      process_command{}, init_commands{"set encoding utf8\nset minussign"},
+      terminal_commands{}, write_timeout{-1.0}, render_timeout{-1.0},
+      error_message{}, restarts{}, settings{},
+      backpressure{Backpressure::BLOCK},
+      frame_in_progress{}, frame_offset{}, queued_frame{},
+      queued_frame_points{}, frame_ack{}, frames{},
+      capabilities{}, transport{DataTransport::TEXT}, smoothing{},
+      smoothing_start{},
+      histogram_bins{}, plot_settings{}, plot_cleanup{},
+      lazy_start{false}, deferred_commands{}, unchecked_terminal{},
+      transport_set{false}, native_renderer{},
+      native_output{}, native_size{} {
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+  static const DaemonLink client{&Gnuplot::pass_memfds,
+                                 &Gnuplot::finish_daemon_job,
+                                 &Gnuplot::wait_for_daemon};
+  daemon_link = &client;
+  connect_to_daemon();
+#endif
+
+  initialize();
+}
+
+GNUPLOTPP_INLINE Gnuplot::Gnuplot(const LazyStart &lazy)
+    : connection{}, child_pid{-1}, series{}, shared_tables{},
+      files_to_delete{}, is_3dplot{false}, executable{lazy.executable},
+      png_terminal{"pngcairo color enhanced"}, png_size{"800,600"},
+      current_terminal{"default"}, panels{}, daemon_client{false},
+      daemon_link{}, daemon_path{}, replay_settings{false}, memfds_to_pass{},
+      ack_fifo{}, ack_fds{-1, -1}, num_acks{},
+      acks_received{}, ack_line{},
+      recording{}, recorded_series{},
+      stats{}, last_show_time{}, last_show_points{}, render_stats{},
+      render_cpu_start{}, measuring_render{false}, memory_budget_kb{},
+      process_command{}, init_commands{"set encoding utf8\nset minussign"},
+      terminal_commands{}, write_timeout{-1.0}, render_timeout{-1.0},
+      error_message{}, restarts{}, settings{},
+      backpressure{Backpressure::BLOCK},
+      frame_in_progress{}, frame_offset{}, queued_frame{},
+      queued_frame_points{}, frame_ack{}, frames{},
+      capabilities{}, transport{DataTransport::TEXT}, smoothing{},
+      smoothing_start{},
+      histogram_bins{}, plot_settings{}, plot_cleanup{}, lazy_start{true},
+      deferred_commands{}, unchecked_terminal{}, transport_set{false},
+      native_renderer{},
+      native_output{}, native_size{} {
+  process_command = lazy.executable;
+  if (lazy.persist)
+    process_command += " --persist";
+
+  initialize();
+}
+
+GNUPLOTPP_INLINE Gnuplot::~Gnuplot() {
+  // Complete a parallel multiplot which was left unfinished
+  if (panels)
+    composite_panels();
+
+#ifndef _WIN32
+  // Frames sent by `submit_frame` must reach Gnuplot as well
+  if (connection && !daemon_client)
+    send_pending_frames();
+#endif
+
+  // Bye bye, Gnuplot!
+  if (connection && daemon_client) {
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+    // The daemon keeps its own copy of the shared memory, but files
+    // on disk can only be removed once it has read them
+    if (!files_to_delete.empty())
+      (this->*daemon_link->finish_job)(render_timeout);
+#endif
+    if (connection)
+      fclose(connection);
+    connection = nullptr;
+  } else if (connection) {
+    stop_process();
+  }
+
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+  for (int fd : memfds_to_pass)
+    close(fd);
+#endif
+
+#ifndef _WIN32
+  for (int fd : ack_fds) {
+    if (fd >= 0)
+      close(fd);
+  }
+#endif
+
+  // Let some time pass before removing the files, so that Gnuplot
+  // can finish displaying the last plot. The daemon has already
+  // replied that it is done with them.
+  if (!lazy_start && !daemon_client)
+    sleep(1);
+
+  // Now remove the data files
+  for (const auto &fname : files_to_delete) {
+    std::remove(fname.c_str());
+  }
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::sendcommand(const char *str) {
+  if (recording)
+    recording->command(str);
+
+  if (panels) {
+    panels->script << str << "\n";
+    return true;
+  }
+
+  remember_settings(str);
+  if (lazy_start) {
+    deferred_commands += str;
+    deferred_commands.push_back('\n');
+    return true;
+  }
+
+  return send_to_gnuplot(str);
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::show(bool call_reset) {
+  GNUPLOTPP_TRACE_SPAN("show", current_terminal);
+
+  bool result{};
+  if (lazy_start && !panels && native_renderer &&
+      (this->*native_renderer)()) {
+    result = true;
+  } else {
+    if (lazy_start && !panels)
+      start_lazy_process();
+
+    std::string command{prepare_plot_command()};
+    start_plot_stats(num_points());
+    if (panels) {
+      result = submit_panel(command);
+    } else {
+      result = sendcommand(command);
+    }
+  }
+
+  if (result && call_reset)
+    reset();
+
+  return result;
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::submit_frame(bool call_reset) {
+#ifdef _WIN32
+  return show(call_reset);
+#else
+  if (panels || daemon_client || lazy_start || !ok())
+    return show(call_reset);
+
+  GNUPLOTPP_TRACE_SPAN("submit_frame", current_terminal);
+  ++frames.submitted;
+
+  flush_frames();
+  std::string command{prepare_plot_command()};
+  command.push_back('\n');
+  const size_t points{num_points()};
+  if (call_reset)
+    reset();
+
+  if (frame_in_progress.empty() && queued_frame.empty() && frame_rendered()) {
+    start_frame(std::move(command), points);
+    flush_frames();
+    return ok();
+  }
+
+  switch (backpressure) {
+  case Backpressure::DROP_NEWEST:
+    ++frames.dropped;
+    return false;
+  case Backpressure::DROP_OLDEST:
+    if (!queued_frame.empty())
+      ++frames.dropped;
+    queued_frame = std::move(command);
+    queued_frame_points = points;
+    return true;
+  default:
+    queued_frame = std::move(command);
+    queued_frame_points = points;
+    return send_pending_frames();
+  }
+#endif
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::flush_frames() {
+#ifdef _WIN32
+  return true;
+#else
+  while (true) {
+    // Start the next frame, if Gnuplot is ready for it
+    if (frame_in_progress.empty()) {
+      if (queued_frame.empty())
+        return true;
+      if (!frame_rendered())
+        return false;
+
+      start_frame(std::move(queued_frame), queued_frame_points);
+      queued_frame.clear();
+    }
+
+    size_t written{};
+    if (!write_available(frame_in_progress.data() + frame_offset,
+                         frame_in_progress.size() - frame_offset, written)) {
+      frame_in_progress.clear();
+      queued_frame.clear();
+      restart_process("Unable to send a frame to Gnuplot");
+      return false;
+    }
+
+    frame_offset += written;
+    if (frame_offset < frame_in_progress.size())
+      return false;
+
+    frame_in_progress.clear();
+    frame_offset = 0;
+  }
+#endif
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::wait_until_rendered(double timeout) {
+  GNUPLOTPP_TRACE_SPAN("render", current_terminal);
+
+#ifdef _WIN32
+  return false;
+#else
+  // Plots drawn by `render_native` are already complete
+  if (lazy_start)
+    return true;
 
-  std::string style_to_str(LineStyle style) {
-    switch (style) {
-    case LineStyle::DOTS:
-      return "dots";
+#ifdef GNUPLOTPP_HAS_DAEMON_CLIENT
+  if (daemon_client && ok())
+    return (this->*daemon_link->wait)(timeout > 0 ? timeout
+                                                  : render_timeout);
+#endif
+
+  if (!ok() || daemon_client || panels || !open_ack_fifo())
+    return false;
+
+  const unsigned expected{++num_acks};
+  if (!send_to_gnuplot(ack_commands(expected).c_str()))
+    return false;
+
+  if (timeout <= 0)
+    timeout = render_timeout;
+
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration<double>(timeout);
+  while (true) {
+    // Wake up a few times per second to check that Gnuplot is alive
+    int wait_ms{child_pid > 0 ? 50 : -1};
+    if (timeout > 0) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0) {
+        restart_process("Gnuplot did not complete the plot in time");
+        return false;
+      }
+      wait_ms = wait_ms < 0 ? int(left.count())
+                            : std::min(wait_ms, int(left.count()));
+    }
+
+    if (child_pid > 0 && waitpid(child_pid, nullptr, WNOHANG) == child_pid) {
+      child_pid = -1;
+      restart_process("Gnuplot terminated unexpectedly");
+      return false;
+    }
+
+    if (memory_budget_kb > 0 && exceeds_memory_budget()) {
+      finish_render_stats();
+      render_stats.aborted = true;
+      restart_process("Gnuplot exceeded the memory budget");
+      return false;
+    }
+
+    pollfd pfd{ack_fds[0], POLLIN, 0};
+    int result{poll(&pfd, 1, wait_ms)};
+    if (result < 0 && errno != EINTR)
+      return false;
+    if (result <= 0)
+      continue;
+
+    read_acks();
+    if (acks_received >= expected) {
+      finish_render_stats();
+      record_render_latency();
+      return true;
+    }
+  }
+#endif
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::render_native() {
+  GNUPLOTPP_TRACE_SPAN("render", "native");
+
+  // PNG images are only drawn by `redirect_to_thumbnail`, as they
+  // lack text
+  const bool png{current_terminal != "svg"};
+  if (series.empty() || is_3dplot)
+    return false;
+
+  for (const auto &s : series) {
+    if (s.y.empty() || !s.filename.empty())
+      return false;
+
+    switch (s.line_style) {
+    case LineStyle::LINES:
+    case LineStyle::STEPS:
+      break;
     case LineStyle::POINTS:
-      return "points";
     case LineStyle::LINESPOINTS:
-      return "linespoints";
-    case LineStyle::STEPS:
-      return "steps";
+    case LineStyle::DOTS:
+      if (png)
+        return false;
+      break;
     case LineStyle::BOXES:
-      return "boxes";
+      if (!png)
+        return false;
+      break;
     default:
-      return "lines";
+      return false;
     }
   }
 
-  std::string format_range(double min = NAN, double max = NAN) {
-    if (std::isnan(min) || std::isnan(max))
-      return "[]";
+  // Any command not sent by the methods below might change the plot
+  NativeFigure fig{};
+  std::string xlabel_command, ylabel_command;
+  std::istringstream commands{deferred_commands};
+  std::string line;
+  while (std::getline(commands, line)) {
+    if (line.empty() || has_line(init_commands, line) ||
+        has_line(terminal_commands, line))
+      continue;
+
+    if (unquote_argument(line, "set xlabel ", fig.xlabel)) {
+      xlabel_command = line;
+    } else if (unquote_argument(line, "set ylabel ", fig.ylabel)) {
+      ylabel_command = line;
+    } else {
+      return false;
+    }
+  }
+
+  if (!layout_native(fig) ||
+      !(png ? write_native_png(fig) : write_native_svg(fig)))
+    return false;
+
+  // Gnuplot only needs the settings still in effect, if it is started.
+  // The terminal is set again only when it starts, as "set output"
+  // would overwrite the file just written.
+  deferred_commands = init_commands + "\n";
+  for (const std::string *command : {&xlabel_command, &ylabel_command}) {
+    if (!command->empty())
+      deferred_commands += *command + "\n";
+  }
+
+  return true;
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::write_native_svg(const NativeFigure &fig) {
+  std::string svg;
+  svg.reserve(4096);
+
+  auto attribute = [&svg](const char *name, double value) {
+    svg += " ";
+    svg += name;
+    svg += "=\"";
+    append_pixel(svg, value);
+    svg += "\"";
+  };
+
+  svg += "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+         "<svg xmlns=\"http://www.w3.org/2000/svg\"";
+  attribute("width", fig.width);
+  attribute("height", fig.height);
+  svg += " viewBox=\"0 0 " + std::to_string(fig.width) + " " +
+         std::to_string(fig.height) +
+         "\" font-family=\"sans-serif\" font-size=\"12\">\n"
+         "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n"
+         "<clipPath id=\"plot\"><rect";
+  attribute("x", fig.left);
+  attribute("y", fig.top);
+  attribute("width", fig.right - fig.left);
+  attribute("height", fig.bottom - fig.top);
+  svg += "/></clipPath>\n";
+
+  if (fig.decorations) {
+    // The border, with tics on all sides as Gnuplot does
+    svg += "<path fill=\"none\" stroke=\"black\" d=\"M";
+    for (double value : {fig.left, fig.top, fig.right, fig.top, fig.right,
+                         fig.bottom, fig.left, fig.bottom}) {
+      append_pixel(svg, value);
+      svg += " ";
+    }
+    svg += "Z";
+    for (double tic : fig.xtics) {
+      for (double y : {fig.bottom, fig.top}) {
+        svg += "M";
+        append_pixel(svg, fig.to_px(tic));
+        svg += " ";
+        append_pixel(svg, y);
+        svg += y == fig.top ? "v6" : "v-6";
+      }
+    }
+    for (double tic : fig.ytics) {
+      for (double x : {fig.left, fig.right}) {
+        svg += "M";
+        append_pixel(svg, x);
+        svg += " ";
+        append_pixel(svg, fig.to_py(tic));
+        svg += x == fig.left ? "h6" : "h-6";
+      }
+    }
+    svg += "\"/>\n<g text-anchor=\"middle\">\n";
+
+    for (double tic : fig.xtics) {
+      svg += "<text";
+      attribute("x", fig.to_px(tic));
+      attribute("y", fig.bottom + 16);
+      svg += ">";
+      append_xml(svg, format_tic(tic), true);
+      svg += "</text>\n";
+    }
+    if (!fig.xlabel.empty()) {
+      svg += "<text";
+      attribute("x", (fig.left + fig.right) / 2);
+      attribute("y", fig.height - 6);
+      svg += ">";
+      append_xml(svg, fig.xlabel);
+      svg += "</text>\n";
+    }
+    if (!fig.ylabel.empty()) {
+      svg += "<text transform=\"translate(14,";
+      append_pixel(svg, (fig.top + fig.bottom) / 2);
+      svg += ") rotate(-90)\">";
+      append_xml(svg, fig.ylabel);
+      svg += "</text>\n";
+    }
+    svg += "</g>\n<g text-anchor=\"end\">\n";
+
+    for (double tic : fig.ytics) {
+      svg += "<text";
+      attribute("x", fig.left - 6);
+      attribute("y", fig.to_py(tic) + 4);
+      svg += ">";
+      append_xml(svg, format_tic(tic), true);
+      svg += "</text>\n";
+    }
+    svg += "</g>\n";
+  }
+
+  std::vector<double> points;
+  size_t key_entries{};
+  for (size_t i{}; i < series.size(); ++i) {
+    const GnuplotSeries &s = series[i];
+    const bool lines{s.line_style == LineStyle::LINES ||
+                     s.line_style == LineStyle::LINESPOINTS ||
+                     s.line_style == LineStyle::STEPS};
+    const bool markers{s.line_style == LineStyle::POINTS ||
+                       s.line_style == LineStyle::LINESPOINTS ||
+                       s.line_style == LineStyle::DOTS};
+    const std::string color{native_color(i)};
+
+    // Markers are crosses, like Gnuplot's default point type, or dots
+    const bool dots{s.line_style == LineStyle::DOTS};
+    const char *marker_path{dots ? "h0" : "m-3 0h6m-3 -3v6"};
+    const char *marker_style{
+        dots ? "\" stroke-width=\"2\" stroke-linecap=\"round\" d=\""
+             : "\" d=\""};
+
+    if (lines) {
+      native_points(fig, s, false, points);
+      svg += "<path clip-path=\"url(#plot)\" fill=\"none\" stroke=\"" + color +
+             "\" d=\"";
+      bool move{true};
+      for (size_t k{}; k < points.size(); k += 2) {
+        if (std::isnan(points[k])) {
+          move = true;
+          continue;
+        }
+
+        svg += move ? "M" : " ";
+        append_pixel(svg, points[k]);
+        svg += " ";
+        append_pixel(svg, points[k + 1]);
+        move = false;
+      }
+      svg += "\"/>\n";
+    }
+
+    if (markers) {
+      native_points(fig, s, true, points);
+      svg += "<path clip-path=\"url(#plot)\" fill=\"none\" stroke=\"" + color +
+             marker_style;
+      for (size_t k{}; k < points.size(); k += 2) {
+        svg += "M";
+        append_pixel(svg, points[k]);
+        svg += " ";
+        append_pixel(svg, points[k + 1]);
+        svg += marker_path;
+      }
+      svg += "\"/>\n";
+    }
+
+    // The key is in the top-right corner, as in Gnuplot
+    if (fig.decorations && !s.title.empty()) {
+      const double y{fig.top + 16.0 * ++key_entries};
+      svg += "<text text-anchor=\"end\"";
+      attribute("x", fig.right - 55);
+      attribute("y", y + 4);
+      svg += ">";
+      append_xml(svg, s.title);
+      svg += "</text>\n<path fill=\"none\" stroke=\"" + color;
+      svg += markers ? marker_style : "\" d=\"";
+      if (lines) {
+        svg += "M";
+        append_pixel(svg, fig.right - 48);
+        svg += " ";
+        append_pixel(svg, y);
+        svg += "h38";
+      }
+      if (markers) {
+        svg += "M";
+        append_pixel(svg, fig.right - 29);
+        svg += " ";
+        append_pixel(svg, y);
+        svg += marker_path;
+      }
+      svg += "\"/>\n";
+    }
+  }
+  svg += "</svg>\n";
+
+  std::ofstream of{native_output, std::ios::binary};
+  of.write(svg.data(), svg.size());
+  return of.good();
+}
+
+GNUPLOTPP_INLINE bool Gnuplot::write_native_png(const NativeFigure &fig) {
+  const int width{fig.width}, height{fig.height};
+  std::vector<unsigned char> pixels(size_t(width) * height);
+
+  // Pixel centers go from 0 to width - 1, like in Gnuplot's terminals
+  NativeFigure area{fig};
+  area.right = width - 1;
+  area.bottom = height - 1;
+
+  // Palette: white, then the color of each series and its fill color
+  // (boxes are filled with "solid 0.5"), then black for the border
+  const size_t ncolors{std::min<size_t>(series.size(), 8)};
+  std::string palette{"\xff\xff\xff"};
+  for (int fill{}; fill < 2; ++fill) {
+    for (size_t i{}; i < ncolors; ++i) {
+      const long rgb{std::strtol(native_color(i) + 1, nullptr, 16)};
+      for (int shift{16}; shift >= 0; shift -= 8) {
+        const long value{(rgb >> shift) & 0xff};
+        palette.push_back(char(fill ? (value + 255) / 2 : value));
+      }
+    }
+  }
+  palette += std::string(3, '\0');
+  const unsigned char black(1 + 2 * ncolors);
+
+  std::vector<double> points;
+  for (size_t i{}; i < series.size(); ++i) {
+    const GnuplotSeries &s = series[i];
+    const unsigned char color(1 + i % 8), fill_color(1 + ncolors + i % 8);
+
+    if (s.line_style != LineStyle::BOXES) {
+      native_points(area, s, false, points);
+      for (size_t k{}; k < points.size(); k += 2) {
+        if (std::isnan(points[k]))
+          continue;
+
+        // A piece made of one point is drawn as a dot
+        const bool last{k + 2 >= points.size() || std::isnan(points[k + 2])};
+        const bool alone{last && (k == 0 || std::isnan(points[k - 2]))};
+        if (alone || !last)
+          draw_line(pixels, width, height, points[k], points[k + 1],
+                    points[k + (alone ? 0 : 2)], points[k + (alone ? 1 : 3)],
+                    color);
+      }
+      continue;
+    }
+
+    // Boxes narrower than a pixel are merged into vertical lines, so
+    // that each column is only drawn once
+    std::vector<int> low(width, height), high(width, -1);
+    const double base{area.to_py(std::max(fig.ymin, std::min(fig.ymax, 0.0)))};
+    for (size_t k{}; k < s.y.size(); ++k) {
+      const double x{s.x.empty() ? double(k) : s.x[k]}, y{s.y[k]};
+      if (!std::isfinite(x) || !std::isfinite(y))
+        continue;
+
+      double left, right;
+      box_edges(s, k, left, right);
+      // Only one pixel beyond each side of the image matters
+      auto clamp = [](double value, int size) {
+        return std::max(-1.0, std::min(double(size), value));
+      };
+      const double px0{clamp(area.to_px(left), width)};
+      const double px1{clamp(area.to_px(right), width)};
+      const double py{clamp(area.to_py(y), height)};
+      const long c0{std::lround(std::min(px0, px1))};
+      const long c1{std::lround(std::max(px0, px1))};
+      const long r0{std::lround(std::min(py, base))};
+      const long r1{std::lround(std::max(py, base))};
+
+      if (c1 - c0 >= 2) {
+        for (long row{std::max(0L, r0 + 1)}; row < std::min(long(height), r1);
+             ++row) {
+          for (long col{std::max(0L, c0 + 1)}; col < std::min(long(width), c1);
+               ++col)
+            pixels[row * width + col] = fill_color;
+        }
+        draw_line(pixels, width, height, c0, r1, c0, r0, color);
+        draw_line(pixels, width, height, c0, r0, c1, r0, color);
+        draw_line(pixels, width, height, c1, r0, c1, r1, color);
+        draw_line(pixels, width, height, c1, r1, c0, r1, color);
+        continue;
+      }
+
+      for (long col{std::max(0L, c0)}; col <= std::min(long(width) - 1, c1);
+           ++col) {
+        low[col] = std::min(low[col], int(std::max(0L, r0)));
+        high[col] = std::max(high[col], int(std::min(long(height) - 1, r1)));
+      }
+    }
+
+    for (int col{}; col < width; ++col) {
+      if (low[col] <= high[col])
+        draw_line(pixels, width, height, col, low[col], col, high[col], color);
+    }
+  }
+
+  // Like Gnuplot, draw the border on the edges of the image (there are
+  // no margins) and in front of the curves
+  draw_line(pixels, width, height, 0, 0, width - 1, 0, black);
+  draw_line(pixels, width, height, width - 1, 0, width - 1, height - 1, black);
+  draw_line(pixels, width, height, width - 1, height - 1, 0, height - 1, black);
+  draw_line(pixels, width, height, 0, height - 1, 0, 0, black);
+
+  // Each row starts with filter type 0 (none)
+  std::string raw;
+  raw.reserve((size_t(width) + 1) * height);
+  for (int row{}; row < height; ++row) {
+    raw.push_back('\0');
+    raw.append(reinterpret_cast<const char *>(pixels.data()) +
+                   size_t(row) * width,
+               width);
+  }
+
+  std::string header;
+  append_be32(header, std::uint32_t(width));
+  append_be32(header, std::uint32_t(height));
+  // 8 bits per pixel, palette colors, no interlacing
+  header += std::string{"\x08\x03\x00\x00\x00", 5};
+
+  std::string png{"\x89PNG\r\n\x1a\n"};
+  append_png_chunk(png, "IHDR", header);
+  append_png_chunk(png, "PLTE", palette);
+  append_png_chunk(png, "IDAT", zlib_compress(raw));
+  append_png_chunk(png, "IEND", "");
+
+  std::ofstream of{native_output, std::ios::binary};
+  of.write(png.data(), png.size());
+  return of.good();
+}
+
+#endif
+
+/* The most used templates are defined outside the class, so that in
+   compiled mode the `extern template` declarations below can prevent
+   the compiler from instantiating them in every file */
+
+template <typename T>
+void Gnuplot::plot(const std::vector<T> &y, const std::string &label,
+                   LineStyle style) {
+  GNUPLOTPP_TRACE_SPAN("plot", label);
+
+  if (y.empty())
+    return;
+
+  if (!series.empty()) {
+    assert(!is_3dplot);
+  }
+
+  if (lazy_start) {
+    add_memory_series<double>(nullptr, y, label, style);
+    return;
+  }
+
+  GNUPLOTPP_TRACE_SPAN("write", label);
+  std::string filename{tmp_file_name()};
+  if (smoothing.kind != Smoothing::Kind::NONE) {
+    SmoothingFilter filter{smoothing_start, smoothing, y};
+    if (transport == DataTransport::BINARY) {
+      write_binary(filename, y.size(), filter);
+    } else {
+      std::ofstream of{filename};
+      assert(of.good());
+      for (size_t i{}; i < y.size(); ++i) {
+        of << filter.next() << "\n";
+      }
+    }
+  } else if (transport == DataTransport::BINARY) {
+    write_binary(filename, y.size(), y);
+  } else {
+    std::ofstream of{filename};
+    assert(of.good());
+    for (const auto &val : y) {
+      of << val << "\n";
+    }
+  }
+
+  series.push_back(GnuplotSeries{filename, style, label, "0:1", y.size()});
+  series.back().binary_format = binary_format(1);
+  is_3dplot = false;
+}
+
+template <typename T, typename U>
+void Gnuplot::plot(const std::vector<T> &x, const std::vector<U> &y,
+                   const std::string &label, LineStyle style) {
+  GNUPLOTPP_TRACE_SPAN("plot", label);
+
+  assert(x.size() == y.size());
+
+  if (x.empty())
+    return;
+
+  if (!series.empty()) {
+    assert(!is_3dplot);
+  }
+
+  if (lazy_start) {
+    add_memory_series(&x, y, label, style);
+    return;
+  }
+
+  GNUPLOTPP_TRACE_SPAN("write", label);
+  std::string filename{tmp_file_name()};
+  if (smoothing.kind != Smoothing::Kind::NONE) {
+    SmoothingFilter filter{smoothing_start, smoothing, y};
+    if (transport == DataTransport::BINARY) {
+      write_binary(filename, x.size(), x, filter);
+    } else {
+      std::ofstream of{filename};
+      assert(of.good());
+      for (size_t i{}; i < x.size(); ++i) {
+        of << x[i] << " " << filter.next() << "\n";
+      }
+    }
+  } else if (transport == DataTransport::BINARY) {
+    write_binary(filename, x.size(), x, y);
+  } else {
+    std::ofstream of{filename};
+    assert(of.good());
+    for (size_t i{}; i < x.size(); ++i) {
+      of << x[i] << " " << y[i] << "\n";
+    }
+  }
+
+  series.push_back(GnuplotSeries{filename, style, label, "1:2", x.size()});
+  series.back().binary_format = binary_format(2);
+  is_3dplot = false;
+}
+
+template <typename T, typename U>
+void Gnuplot::plot3d(const std::vector<T> &x, const std::vector<U> &y,
+                     const std::vector<U> &z, const std::string &label,
+                     LineStyle style) {
+  GNUPLOTPP_TRACE_SPAN("plot", label);
+
+  assert(x.size() == y.size());
+  assert(x.size() == z.size());
+
+  if (x.empty())
+    return;
+
+  if (!series.empty()) {
+    assert(is_3dplot);
+  }
+
+  GNUPLOTPP_TRACE_SPAN("write", label);
+  std::string filename{tmp_file_name()};
+  if (transport == DataTransport::BINARY) {
+    write_binary(filename, x.size(), x, y, z);
+  } else {
+    std::ofstream of{filename};
+    assert(of.good());
+    for (size_t i{}; i < x.size(); ++i) {
+      of << x[i] << " " << y[i] << " " << z[i] << "\n";
+    }
+  }
+
+  series.push_back(GnuplotSeries{filename, style, label, "1:2:3", x.size()});
+  series.back().binary_format = binary_format(3);
+  is_3dplot = true;
+}
+
+template <typename T>
+void Gnuplot::histogram(const std::vector<T> &values, size_t nbins,
+                        const std::string &label, LineStyle style,
+                        HistogramNorm norm) {
+  GNUPLOTPP_TRACE_SPAN("plot", label);
+
+  assert(nbins > 0);
+
+  if (values.empty())
+    return;
+
+  if (!series.empty()) {
+    assert(!is_3dplot);
+  }
+
+  // Comparing values instead of iterators lets the compiler vectorize
+  // the loop
+  T lowest{values.front()}, highest{values.front()};
+  for (const auto &val : values) {
+    lowest = std::min(lowest, val);
+    highest = std::max(highest, val);
+  }
+
+  const double min{double(lowest)};
+  const double max{double(highest)};
+  // If all the values are the same, they go in the first bin
+  const double binwidth{max > min ? (max - min) / nbins : 1.0};
+
+  std::vector<size_t> bins{count_bins(values, lowest, highest, binwidth,
+                                      nbins, std::is_integral<T>{})};
+
+  // The edges and the normalized values are computed while writing
+  // the data file, so that they are available to `last_histogram`
+  GNUPLOTPP_TRACE_SPAN("write", label);
+  histogram_bins.edges.resize(nbins + 1);
+  histogram_bins.values.resize(nbins);
+  histogram_bins.counts = bins;
+
+  const double total{double(values.size())};
+  std::string filename{tmp_file_name()};
+  std::ofstream of{filename};
+  assert(of.good());
+  size_t cumulative{};
+  for (size_t i{}; i < nbins; ++i) {
+    cumulative += bins[i];
+
+    double value{};
+    switch (norm) {
+    case HistogramNorm::DENSITY:
+      value = bins[i] / (total * binwidth);
+      break;
+    case HistogramNorm::PROBABILITY:
+      value = bins[i] / total;
+      break;
+    case HistogramNorm::CUMULATIVE:
+      value = cumulative / total;
+      break;
+    default:
+      value = double(bins[i]);
+    }
+
+    histogram_bins.edges[i] = min + binwidth * i;
+    histogram_bins.values[i] = value;
+    of << min + binwidth * (i + 0.5) << " " << value << "\n";
+  }
+  histogram_bins.edges[nbins] = max > min ? max : min + binwidth * nbins;
+
+  series.push_back(GnuplotSeries{filename, style, label, "1:2", nbins});
+  is_3dplot = false;
+}
+
+#define GNUPLOTPP_INSTANTIATE(PREFIX, T)                                       \
+  PREFIX template void Gnuplot::plot<T>(const std::vector<T> &,               \
+                                        const std::string &,                   \
+                                        Gnuplot::LineStyle);                   \
+  PREFIX template void Gnuplot::plot<T, T>(                                    \
+      const std::vector<T> &, const std::vector<T> &, const std::string &,     \
+      Gnuplot::LineStyle);                                                     \
+  PREFIX template void Gnuplot::plot3d<T, T>(                                  \
+      const std::vector<T> &, const std::vector<T> &, const std::vector<T> &,  \
+      const std::string &, Gnuplot::LineStyle);                                \
+  PREFIX template void Gnuplot::histogram<T>(                                  \
+      const std::vector<T> &, size_t, const std::string &, Gnuplot::LineStyle, \
+      Gnuplot::HistogramNorm);
+
+#if defined(GNUPLOTPP_COMPILED) && defined(GNUPLOTPP_IMPLEMENTATION)
+GNUPLOTPP_INSTANTIATE(, int)
+GNUPLOTPP_INSTANTIATE(, float)
+GNUPLOTPP_INSTANTIATE(, double)
+#elif defined(GNUPLOTPP_COMPILED)
+GNUPLOTPP_INSTANTIATE(extern, int)
+GNUPLOTPP_INSTANTIATE(extern, float)
+GNUPLOTPP_INSTANTIATE(extern, double)
+#endif
+
+/* The process pool, the parallel multiplots, the tracing and the
+   reports of the latencies are compiled only in the file defining
+   GNUPLOTPP_IMPLEMENTATION, in the header-only mode too: they are the
+   only code needing the headers below, and compiling them in every
+   file would take several seconds each time. */
+#ifdef GNUPLOTPP_IMPLEMENTATION
+
+#include <condition_variable>
+#include <deque>
+
+struct GnuplotTrace::State {
+  std::mutex mutex;
+  std::vector<Event> events;
+};
+
+GnuplotTrace::State &GnuplotTrace::get_state() {
+  static State state;
+  return state;
+}
+
+void GnuplotTrace::record(const char *name, const std::string &tag,
+                          std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end) {
+  static std::atomic<int> num_threads{0};
+  thread_local int thread_index{++num_threads};
+
+  State &state = get_state();
+  std::lock_guard<std::mutex> lock{state.mutex};
+  state.events.push_back(Event{name, tag, start, end, thread_index});
+}
+
+bool GnuplotTrace::save(const std::string &filename) {
+  State &state = get_state();
+  std::lock_guard<std::mutex> lock{state.mutex};
+
+#ifdef _WIN32
+  const long pid{long(GetCurrentProcessId())};
+#else
+  const long pid{long(getpid())};
+#endif
+
+  std::ofstream of{filename};
+  of << "{\"traceEvents\": [\n";
+  for (size_t i{}; i < state.events.size(); ++i) {
+    const Event &ev = state.events[i];
+    using us = std::chrono::microseconds;
+    of << "{\"name\": \"" << ev.name << "\", \"ph\": \"X\", \"ts\": "
+       << std::chrono::duration_cast<us>(ev.start.time_since_epoch()).count()
+       << ", \"dur\": "
+       << std::chrono::duration_cast<us>(ev.end - ev.start).count()
+       << ", \"pid\": " << pid << ", \"tid\": " << ev.thread_index
+       << ", \"args\": {\"tag\": \"" << escape_json(ev.tag) << "\"}}"
+       << (i + 1 < state.events.size() ? ",\n" : "\n");
+  }
+  of << "], \"displayTimeUnit\": \"ms\"}\n";
+
+  return of.good();
+}
+
+void GnuplotTrace::clear() {
+  State &state = get_state();
+  std::lock_guard<std::mutex> lock{state.mutex};
+  state.events.clear();
+}
+
+void GnuplotLatencyStats::merge(const GnuplotLatencyStats &other) {
+  for (const Entry *cur{other.newest.load(std::memory_order_acquire)}; cur;
+       cur = cur->next)
+    histogram(cur->category).merge(cur->histogram);
+}
+
+std::vector<GnuplotLatencyStats::CategorySnapshot>
+GnuplotLatencyStats::snapshot() const {
+  std::vector<CategorySnapshot> result;
+  for (const Entry *cur{newest.load(std::memory_order_acquire)}; cur;
+       cur = cur->next)
+    result.emplace_back(cur->category, cur->histogram.snapshot());
+
+  std::sort(result.begin(), result.end(),
+            [](const CategorySnapshot &a, const CategorySnapshot &b) {
+              return a.first < b.first;
+            });
+  return result;
+}
+
+std::string GnuplotLatencyStats::to_text() const {
+  std::stringstream os;
+  for (const auto &entry : snapshot()) {
+    const auto &snap = entry.second;
+    os << entry.first << ": count = " << snap.count
+       << ", mean = " << snap.mean() * 1e3
+       << " ms, p50 = " << snap.percentile(50) * 1e3
+       << " ms, p90 = " << snap.percentile(90) * 1e3
+       << " ms, p99 = " << snap.percentile(99) * 1e3
+       << " ms, max = " << snap.max_seconds * 1e3 << " ms\n";
+  }
+
+  return os.str();
+}
+
+std::string GnuplotLatencyStats::to_json() const {
+  std::stringstream os;
+  os << "{";
+  bool first{true};
+  for (const auto &entry : snapshot()) {
+    const auto &snap = entry.second;
+    os << (first ? "" : ", ") << "\""
+       << GnuplotTrace::escape_json(entry.first) << "\": {"
+       << "\"count\": " << snap.count << ", \"mean\": " << snap.mean()
+       << ", \"min\": " << snap.min_seconds
+       << ", \"p50\": " << snap.percentile(50)
+       << ", \"p90\": " << snap.percentile(90)
+       << ", \"p99\": " << snap.percentile(99)
+       << ", \"max\": " << snap.max_seconds << "}";
+    first = false;
+  }
+  os << "}";
+
+  return os.str();
+}
 
+struct GnuplotPool::JobState {
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool done;
+  Result result;
+};
+
+struct GnuplotPool::Impl {
+  struct Job {
+    std::string script;
+    std::chrono::steady_clock::time_point submitted;
+    double timeout;
+    std::shared_ptr<JobState> state;
+  };
+
+  std::deque<Job> jobs;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool stopping;
+  // Set by `set_timeout`, copied in each job
+  double timeout;
+};
+
+GnuplotPool::Result GnuplotPool::Pending::get() {
+  std::unique_lock<std::mutex> lock{state->mutex};
+  state->cond.wait(lock, [this] { return state->done; });
+  return state->result;
+}
+
+GnuplotPool::GnuplotPool(size_t num_workers,
+                         const std::string &executable_name)
+    : executable{executable_name}, stats{}, impl{new Impl{}} {
+  if (num_workers == 0)
+    num_workers = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t i{}; i < num_workers; ++i)
+    impl->workers.emplace_back([this] { worker_loop(); });
+}
+
+GnuplotPool::~GnuplotPool() {
+  {
+    std::lock_guard<std::mutex> lock{impl->mutex};
+    impl->stopping = true;
+  }
+  impl->cond.notify_all();
+
+  for (auto &worker : impl->workers)
+    worker.join();
+}
+
+GnuplotPool::Pending GnuplotPool::submit(const std::string &script) {
+  std::shared_ptr<JobState> state{std::make_shared<JobState>()};
+  {
+    std::lock_guard<std::mutex> lock{impl->mutex};
+    impl->jobs.push_back(
+        Impl::Job{script, std::chrono::steady_clock::now(), impl->timeout,
+                  state});
+  }
+  impl->cond.notify_one();
+
+  return Pending{state};
+}
+
+size_t GnuplotPool::size() const { return impl->workers.size(); }
+
+void GnuplotPool::set_timeout(double seconds) {
+  std::lock_guard<std::mutex> lock{impl->mutex};
+  impl->timeout = seconds;
+}
+
+void GnuplotPool::worker_loop() {
+  long pid{};
+  FILE *process{Gnuplot::spawn_process(executable, pid)};
+
+  // Used to stop the process kept ready when the pool is destroyed
+  double stop_timeout{};
+  while (true) {
+    Impl::Job job;
+    {
+      std::unique_lock<std::mutex> lock{impl->mutex};
+      impl->cond.wait(lock,
+                      [this] { return impl->stopping || !impl->jobs.empty(); });
+      if (impl->jobs.empty()) {
+        stop_timeout = impl->timeout;
+        break;
+      }
+
+      job = std::move(impl->jobs.front());
+      impl->jobs.pop_front();
+    }
+
+    if (!process)
+      process = Gnuplot::spawn_process(executable, pid);
+
+    auto render_start = std::chrono::steady_clock::now();
+    bool ok{process != nullptr};
+    if (ok) {
+      ok = Gnuplot::write_all(process, job.script + "\n", job.timeout);
+
+      // Whatever time is left is given to Gnuplot to complete the plot;
+      // if there is none, the process is killed at once
+      double timeout{job.timeout};
+      if (timeout > 0) {
+        std::chrono::duration<double> elapsed{
+            std::chrono::steady_clock::now() - render_start};
+        timeout = std::max(timeout - elapsed.count(), 1e-3);
+      }
+      ok = Gnuplot::close_process(process, pid, timeout) && ok;
+    }
+
+    if (ok) {
+      std::chrono::duration<double> render_time{
+          std::chrono::steady_clock::now() - render_start};
+      stats.record("terminal=" + terminal_name(job.script),
+                   render_time.count());
+    }
+
+    // Start the process for the next job while this one is reported
+    process = Gnuplot::spawn_process(executable, pid);
+
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          job.submitted};
+    {
+      std::lock_guard<std::mutex> lock{job.state->mutex};
+      job.state->result = Result{ok, elapsed.count()};
+      job.state->done = true;
+    }
+    job.state->cond.notify_all();
+  }
+
+  if (process)
+    Gnuplot::close_process(process, pid, stop_timeout);
+}
+
+std::string GnuplotPool::terminal_name(const std::string &script) {
+  const std::string command{"set terminal "};
+  size_t pos{script.rfind(command)};
+  if (pos == std::string::npos)
+    return "default";
+
+  pos += command.size();
+  return script.substr(pos, script.find_first_of(" \n", pos) - pos);
+}
+
+struct Gnuplot::PooledMultiplot : public Gnuplot::ParallelMultiplot {
+  PooledMultiplot(Gnuplot &owner, size_t num_workers)
+      : gp(owner), nrows{}, ncols{}, title{}, title_fraction{},
+        panel_width{}, panel_height{}, images{}, results{},
+        pool{num_workers, owner.executable} {
+    // Each plot must be completed within the render timeout
+    pool.set_timeout(owner.render_timeout);
+  }
+
+  void submit(const std::string &plot_command) override {
+    std::string image{gp.tmp_file_name()};
+
+    // Like in `multiplot`, the settings made before the figure apply
+    // to every plot; the terminal is replaced by the one of the panel
     std::stringstream os;
-    os << "[" << min << ":" << max << "]";
+    os << gp.init_commands << "\n"
+       << "set terminal " << gp.png_terminal << " size " << panel_width
+       << "," << panel_height << "\n"
+       << "set output '" << image << "'\n"
+       << gp.remembered_settings() << script.str() << plot_command << "\n";
 
-    return os.str();
+    script.str("");
+    images.push_back(image);
+    results.push_back(pool.submit(os.str()));
   }
 
-  FILE *connection;
-  std::vector<GnuplotSeries> series;
-  std::vector<std::string> files_to_delete;
-  std::string xrange;
-  std::string yrange;
-  std::string zrange;
-  bool is_3dplot;
+  bool complete() const override {
+    return int(images.size()) == nrows * ncols;
+  }
+
+  bool composite() override {
+    if (images.empty())
+      return true;
+
+    bool all_ok{true};
+    for (auto &result : results)
+      all_ok = result.get().ok && all_ok;
+
+    // Save the current settings, as the ones needed to paste images
+    // would break the next plots
+    std::string settings{gp.tmp_file_name()};
+    std::stringstream os;
+    os << "save set '" << settings << "'\n"
+       << "set multiplot title '" << gp.escape_quotes(title) << "'\n"
+       << "unset key\n"
+       << "unset tics\n"
+       << "unset border\n"
+       << "set margins 0, 0, 0, 0\n"
+       << "set autoscale fix\n";
+
+    double width{1.0 / ncols};
+    double height{(1.0 - title_fraction) / nrows};
+    for (size_t i{}; i < images.size(); ++i) {
+      int row = i / ncols, col = i % ncols;
+      os << "set origin " << col * width << ", "
+         << 1.0 - title_fraction - (row + 1) * height << "\n"
+         << "set size " << width << ", " << height << "\n"
+         << "plot '" << images[i]
+         << "' binary filetype=png with rgbimage notitle\n";
+    }
+    os << "unset multiplot\n"
+       << "load '" << settings << "'";
+
+    return gp.send_to_gnuplot(os.str().c_str()) && all_ok;
+  }
+
+  Gnuplot &gp;
+  int nrows, ncols;
+  std::string title;
+  double title_fraction;
+  int panel_width, panel_height;
+  std::vector<std::string> images;
+  std::vector<GnuplotPool::Pending> results;
+  GnuplotPool pool;
 };
+
+bool Gnuplot::parallel_multiplot(int nrows, int ncols,
+                                 const std::string &title,
+                                 size_t num_workers) {
+  assert(nrows > 0 && ncols > 0);
+
+  // The daemon already renders plots in parallel
+  if (daemon_client)
+    return multiplot(nrows, ncols, title);
+
+  if (panels)
+    composite_panels();
+
+  int width{800}, height{600};
+  std::sscanf(png_size.c_str(), "%d,%d", &width, &height);
+
+  std::unique_ptr<PooledMultiplot> mp{new PooledMultiplot{*this, num_workers}};
+  mp->nrows = nrows;
+  mp->ncols = ncols;
+  mp->title = title;
+  // Leave some room for the title above the plots
+  mp->title_fraction =
+      title.empty() ? 0.0 : std::min(0.1, 30.0 / std::max(height, 1));
+  mp->panel_width = std::max(1, width / ncols);
+  mp->panel_height =
+      std::max(1, int(height * (1.0 - mp->title_fraction)) / nrows);
+  panels = std::move(mp);
+
+  return ok();
+}
+
+#endif
@@ -0,0 +1,287 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Render daemon for gplot++
+ *
+ * This program keeps a pool of Gnuplot processes ready and listens on
+ * a Unix socket. Programs using `Gnuplot{Gnuplot::DaemonSocket{}}`
+ * connect to it, send their commands and pass their data through
+ * shared memory; once they shut down their side of the connection,
+ * the commands are run by the first free Gnuplot process and the
+ * daemon replies "gplotpp-done ok" or "gplotpp-done error". At most
+ * MAX_CLIENTS clients are served at the same time (by default, four
+ * for each Gnuplot process); the others wait in the socket backlog.
+ * Gnuplot processes taking more than SECONDS to run the commands of a
+ * client are killed, and the client gets "gplotpp-done error".
+ *
+ * Usage: gplotpp-daemon [-s SOCKET] [-n NUM_WORKERS] [-c MAX_CLIENTS]
+ *                       [-g GNUPLOT] [-t SECONDS]
+ */
+
+// Compile GnuplotPool, which is not part of the header-only core
+#define GNUPLOTPP_IMPLEMENTATION
+#include "gplot++.h"
+
+#ifndef GNUPLOTPP_HAS_DAEMON_CLIENT
+
+#include <iostream>
+
+int main() {
+  std::cerr << "The render daemon is only available on Linux\n";
+  return 1;
+}
+
+#else
+
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+
+// Descriptors received from a client
+struct ClientData {
+  // Descriptors not yet associated with a number, in order of arrival
+  std::deque<int> received;
+  // Descriptor number in the client → path of the data in the daemon
+  std::map<int, std::string> paths;
+  std::vector<int> to_close;
+};
+
+// Number of clients that can still be served at the same time
+class ClientSlots {
+public:
+  explicit ClientSlots(size_t count) : free{count}, mutex{}, cond{} {}
+
+  void acquire() {
+    std::unique_lock<std::mutex> lock{mutex};
+    cond.wait(lock, [this] { return free > 0; });
+    --free;
+  }
+
+  void release() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      ++free;
+    }
+    cond.notify_one();
+  }
+
+private:
+  size_t free;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+// Read everything a client sends, collecting the descriptors passed
+// along the data
+std::string read_client(int sock, ClientData &data) {
+  std::string result;
+  char buffer[65536];
+  char control[CMSG_SPACE(16 * sizeof(int))];
+
+  while (true) {
+    iovec iov{buffer, sizeof(buffer)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t nbytes{recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)};
+    if (nbytes < 0 && errno == EINTR)
+      continue;
+    if (nbytes <= 0)
+      break;
+
+    for (cmsghdr *cmsg{CMSG_FIRSTHDR(&msg)}; cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+
+      size_t count{(cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)};
+      for (size_t i{}; i < count; ++i) {
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        data.received.push_back(fd);
+        data.to_close.push_back(fd);
+      }
+    }
+
+    result.append(buffer, nbytes);
+  }
+
+  return result;
+}
+
+// Turn the commands sent by a client into a script that a Gnuplot
+// process started by the daemon can run
+std::string translate_script(const std::string &input, ClientData &data) {
+  const std::string announce{"# gplotpp-fd "};
+  const std::string announce_file{"# gplotpp-file "};
+  const std::string client_path{"/proc/self/fd/"};
+  const std::string daemon_path{"/proc/" + std::to_string(getpid()) +
+                                "/fd/"};
+
+  std::string script;
+  std::istringstream is{input};
+  std::string line;
+  while (std::getline(is, line)) {
+    if (line.compare(0, announce.size(), announce) == 0) {
+      if (!data.received.empty()) {
+        data.paths[std::atoi(line.c_str() + announce.size())] =
+            daemon_path + std::to_string(data.received.front());
+        data.received.pop_front();
+      }
+      continue;
+    }
+
+    // The client could not pass the descriptor and saved the data in
+    // a file: "# gplotpp-file FD PATH"
+    if (line.compare(0, announce_file.size(), announce_file) == 0) {
+      size_t path_start{line.find(' ', announce_file.size())};
+      if (path_start != std::string::npos)
+        data.paths[std::atoi(line.c_str() + announce_file.size())] =
+            line.substr(path_start + 1);
+      continue;
+    }
+
+    size_t pos{};
+    while ((pos = line.find(client_path, pos)) != std::string::npos) {
+      size_t end{pos + client_path.size()};
+      int client_fd{std::atoi(line.c_str() + end)};
+      while (end < line.size() && std::isdigit(line[end]))
+        ++end;
+
+      auto it = data.paths.find(client_fd);
+      if (it == data.paths.end()) {
+        pos = end;
+        continue;
+      }
+
+      line.replace(pos, end - pos, it->second);
+      pos += it->second.size();
+    }
+
+    script += line;
+    script += "\n";
+  }
+
+  return script;
+}
+
+void serve_client(int sock, GnuplotPool &pool) {
+  ClientData data;
+  std::string script{translate_script(read_client(sock, data), data)};
+
+  // The shared memory files must stay open until Gnuplot has read them
+  GnuplotPool::Result result{pool.submit(script).get()};
+  for (int fd : data.to_close)
+    close(fd);
+
+  // The client may have closed the connection without waiting
+  const std::string reply{result.ok ? "gplotpp-done ok\n"
+                                    : "gplotpp-done error\n"};
+  send(sock, reply.data(), reply.size(), MSG_NOSIGNAL);
+  close(sock);
+
+  if (!result.ok)
+    std::cerr << "gplotpp-daemon: Gnuplot reported an error or timed out\n";
+}
+
+int main(int argc, const char *argv[]) {
+  std::string socket_path{Gnuplot::DaemonSocket{}.path};
+  std::string executable{"gnuplot"};
+  size_t num_workers{};
+  size_t max_clients{};
+  double timeout{-1.0};
+
+  for (int i{1}; i + 1 < argc; i += 2) {
+    std::string flag{argv[i]};
+    if (flag == "-s") {
+      socket_path = argv[i + 1];
+    } else if (flag == "-n") {
+      num_workers = std::atoi(argv[i + 1]);
+    } else if (flag == "-c") {
+      max_clients = std::atoi(argv[i + 1]);
+    } else if (flag == "-g") {
+      executable = argv[i + 1];
+    } else if (flag == "-t") {
+      timeout = std::atof(argv[i + 1]);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [-s SOCKET] [-n NUM_WORKERS] [-c MAX_CLIENTS]"
+                   " [-g GNUPLOT] [-t SECONDS]\n";
+      return 1;
+    }
+  }
+
+  std::signal(SIGPIPE, SIG_IGN);
+
+  int listener{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  unlink(socket_path.c_str());
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(listener, 128) != 0) {
+    std::cerr << "Unable to listen on " << socket_path << ": "
+              << std::strerror(errno) << "\n";
+    return 1;
+  }
+
+  GnuplotPool pool{num_workers, executable};
+  pool.set_timeout(timeout);
+  if (max_clients == 0)
+    max_clients = 4 * pool.size();
+  ClientSlots slots{max_clients};
+  std::cerr << "gplotpp-daemon: listening on " << socket_path << " with "
+            << pool.size() << " Gnuplot processes\n";
+
+  while (true) {
+    slots.acquire();
+    int client{accept4(listener, nullptr, nullptr, SOCK_CLOEXEC)};
+    if (client < 0) {
+      slots.release();
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    std::thread{[client, &pool, &slots] {
+      serve_client(client, pool);
+      slots.release();
+    }}.detach();
+  }
+
+  close(listener);
+  unlink(socket_path.c_str());
+}
+
+#endif
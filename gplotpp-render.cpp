@@ -0,0 +1,495 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Batch renderer for gplot++
+ *
+ * This program reads a list of figures, one JSON object per line, and
+ * renders them using a pool of Gnuplot processes. Here is an example
+ * of a figure (split on several lines for clarity):
+ *
+ *   {"output": "fig.png", "size": "800,600", "quality": "draft",
+ *    "title": "Speed", "xlabel": "Time [s]", "ylabel": "Speed [m/s]",
+ *    "xrange": [0, 10], "yrange": [0, 5], "logscale": "y",
+ *    "series": [{"file": "speed.txt", "using": "1:2",
+ *                "style": "lines", "title": "Car #1"}]}
+ *
+ * Only "output" and "series" are mandatory, and each series needs a
+ * "file". The output format is chosen from the extension of "output"
+ * (.png, .pdf or .svg). When all the figures have been rendered, the
+ * program prints the throughput, the latency percentiles and the list
+ * of figures that could not be rendered.
+ *
+ * Usage: gplotpp-render [-n NUM_WORKERS] [-g GNUPLOT] [-t SECONDS] [FILE]
+ *
+ * If FILE is not provided, the figures are read from the standard input.
+ * Figures taking more than SECONDS to render are reported as failed.
+ */
+
+// Compile GnuplotPool, which is not part of the header-only core
+#define GNUPLOTPP_IMPLEMENTATION
+#include "gplot++.h"
+#include <cctype>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+// A JSON value; only the fields needed by the value type are used
+struct Json {
+  enum class Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+  Type type{Type::NUL};
+  bool boolean{};
+  double number{};
+  std::string str;
+  std::vector<Json> array;
+  std::map<std::string, Json> object;
+
+  const Json *get(const std::string &key) const {
+    auto it = object.find(key);
+    return it == object.end() ? nullptr : &it->second;
+  }
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(const std::string &text) : s{text}, pos{} {}
+
+  Json parse() {
+    Json result{parse_value()};
+    skip_spaces();
+    if (pos != s.size())
+      fail("unexpected characters after the end of the object");
+
+    return result;
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &msg) {
+    throw std::runtime_error{"column " + std::to_string(pos + 1) + ": " +
+                             msg};
+  }
+
+  void skip_spaces() {
+    while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos])))
+      ++pos;
+  }
+
+  void expect(char c) {
+    skip_spaces();
+    if (pos >= s.size() || s[pos] != c)
+      fail(std::string{"expected '"} + c + "'");
+    ++pos;
+  }
+
+  bool accept(const std::string &word) {
+    if (s.compare(pos, word.size(), word) != 0)
+      return false;
+
+    pos += word.size();
+    return true;
+  }
+
+  Json parse_value() {
+    skip_spaces();
+    if (pos >= s.size())
+      fail("unexpected end of line");
+
+    Json value;
+    char c{s[pos]};
+    if (c == '{') {
+      value.type = Json::Type::OBJECT;
+      ++pos;
+      skip_spaces();
+      if (pos < s.size() && s[pos] == '}') {
+        ++pos;
+        return value;
+      }
+      do {
+        skip_spaces();
+        std::string key{parse_string()};
+        expect(':');
+        value.object[key] = parse_value();
+        skip_spaces();
+      } while (pos < s.size() && s[pos] == ',' && ++pos);
+      expect('}');
+    } else if (c == '[') {
+      value.type = Json::Type::ARRAY;
+      ++pos;
+      skip_spaces();
+      if (pos < s.size() && s[pos] == ']') {
+        ++pos;
+        return value;
+      }
+      do {
+        value.array.push_back(parse_value());
+        skip_spaces();
+      } while (pos < s.size() && s[pos] == ',' && ++pos);
+      expect(']');
+    } else if (c == '"') {
+      value.type = Json::Type::STRING;
+      value.str = parse_string();
+    } else if (accept("true")) {
+      value.type = Json::Type::BOOLEAN;
+      value.boolean = true;
+    } else if (accept("false")) {
+      value.type = Json::Type::BOOLEAN;
+    } else if (accept("null")) {
+      value.type = Json::Type::NUL;
+    } else {
+      const char *start{s.c_str() + pos};
+      char *end{};
+      value.type = Json::Type::NUMBER;
+      value.number = std::strtod(start, &end);
+      if (end == start)
+        fail("invalid value");
+      pos += end - start;
+    }
+
+    return value;
+  }
+
+  std::string parse_string() {
+    if (pos >= s.size() || s[pos] != '"')
+      fail("expected a string");
+    ++pos;
+
+    std::string result;
+    while (pos < s.size() && s[pos] != '"') {
+      char c{s[pos++]};
+      if (c != '\\') {
+        result.push_back(c);
+        continue;
+      }
+
+      if (pos >= s.size())
+        break;
+      c = s[pos++];
+      switch (c) {
+      case 'n':
+        result.push_back('\n');
+        break;
+      case 't':
+        result.push_back('\t');
+        break;
+      case 'r':
+      case 'b':
+      case 'f':
+        break;
+      case 'u': {
+        // Encode the code point in UTF-8 (surrogate pairs are not
+        // supported)
+        unsigned long code{
+            std::strtoul(s.substr(pos, 4).c_str(), nullptr, 16)};
+        pos += 4;
+        if (code < 0x80) {
+          result.push_back(char(code));
+        } else if (code < 0x800) {
+          result.push_back(char(0xC0 | (code >> 6)));
+          result.push_back(char(0x80 | (code & 0x3F)));
+        } else {
+          result.push_back(char(0xE0 | (code >> 12)));
+          result.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+          result.push_back(char(0x80 | (code & 0x3F)));
+        }
+        break;
+      }
+      default:
+        result.push_back(c);
+      }
+    }
+
+    if (pos >= s.size())
+      fail("unterminated string");
+    ++pos;
+
+    return result;
+  }
+
+  const std::string &s;
+  size_t pos;
+};
+
+std::string quote(const std::string &s) {
+  std::string result{"'"};
+  for (char c : s) {
+    if (c == '\'')
+      result += "''";
+    else
+      result.push_back(c);
+  }
+  result.push_back('\'');
+
+  return result;
+}
+
+std::string get_string(const Json &spec, const std::string &key,
+                       const std::string &default_value = "") {
+  const Json *value{spec.get(key)};
+  if (!value)
+    return default_value;
+
+  if (value->type != Json::Type::STRING)
+    throw std::runtime_error{"\"" + key + "\" must be a string"};
+
+  // A newline would end the Gnuplot command and start another one
+  for (char c : value->str) {
+    if (static_cast<unsigned char>(c) < 0x20 || c == 0x7F)
+      throw std::runtime_error{"\"" + key +
+                               "\" must not contain control characters"};
+  }
+
+  return value->str;
+}
+
+/* Return a string that is put in the script without quotes (e.g.,
+   "using" and "size"), so it must not contain another command, a
+   string or a backquoted shell command */
+std::string get_expression(const Json &spec, const std::string &key,
+                           const std::string &default_value) {
+  std::string value{get_string(spec, key, default_value)};
+  if (value.find_first_of(";'\"`#") != std::string::npos)
+    throw std::runtime_error{"\"" + key +
+                             "\" must not contain ; ' \" ` or #"};
+
+  return value;
+}
+
+std::string get_range(const Json &spec, const std::string &key) {
+  const Json *value{spec.get(key)};
+  if (!value)
+    return "[]";
+
+  if (value->type != Json::Type::ARRAY || value->array.size() != 2 ||
+      value->array[0].type != Json::Type::NUMBER ||
+      value->array[1].type != Json::Type::NUMBER)
+    throw std::runtime_error{"\"" + key + "\" must be an array of two numbers"};
+
+  std::stringstream os;
+  os << "[" << value->array[0].number << ":" << value->array[1].number << "]";
+  return os.str();
+}
+
+// Turn the specification of a figure into a Gnuplot script
+std::string make_script(const Json &spec) {
+  if (spec.type != Json::Type::OBJECT)
+    throw std::runtime_error{"the figure must be a JSON object"};
+
+  std::string output{get_string(spec, "output")};
+  if (output.empty())
+    throw std::runtime_error{"missing \"output\""};
+
+  std::string extension{output.substr(output.find_last_of('.') + 1)};
+  std::string quality{get_string(spec, "quality", "normal")};
+  std::stringstream os;
+  os << "set encoding utf8\n"
+     << "set minussign\n";
+  if (extension == "pdf") {
+    os << "set terminal pdfcairo color enhanced size "
+       << get_expression(spec, "size", "16cm,12cm") << "\n";
+  } else if (extension == "svg") {
+    os << "set terminal svg enhanced size "
+       << get_expression(spec, "size", "800,600") << "\n";
+  } else if (extension == "png") {
+    if (quality == "draft")
+      os << "set terminal png";
+    else if (quality == "publication")
+      os << "set terminal pngcairo color enhanced rounded linewidth 1.5";
+    else
+      os << "set terminal pngcairo color enhanced";
+    os << " size " << get_expression(spec, "size", "800,600") << "\n";
+  } else {
+    throw std::runtime_error{"unknown output format \"" + extension + "\""};
+  }
+  os << "set output " << quote(output) << "\n";
+
+  if (spec.get("title"))
+    os << "set title " << quote(get_string(spec, "title")) << "\n";
+  if (spec.get("xlabel"))
+    os << "set xlabel " << quote(get_string(spec, "xlabel")) << "\n";
+  if (spec.get("ylabel"))
+    os << "set ylabel " << quote(get_string(spec, "ylabel")) << "\n";
+
+  std::string logscale{get_string(spec, "logscale")};
+  if (logscale == "x" || logscale == "y" || logscale == "xy")
+    os << "set logscale " << logscale << "\n";
+  else if (!logscale.empty())
+    throw std::runtime_error{"\"logscale\" must be \"x\", \"y\" or \"xy\""};
+
+  const Json *series{spec.get("series")};
+  if (!series || series->type != Json::Type::ARRAY || series->array.empty())
+    throw std::runtime_error{"\"series\" must be a non-empty array"};
+
+  static const std::vector<std::string> styles{
+      "dots", "lines", "points", "linespoints", "steps", "boxes"};
+
+  os << "set style fill solid 0.5\n"
+     << "plot " << get_range(spec, "xrange") << " "
+     << get_range(spec, "yrange") << " ";
+  for (size_t i{}; i < series->array.size(); ++i) {
+    const Json &s = series->array[i];
+    if (s.type != Json::Type::OBJECT)
+      throw std::runtime_error{"each series must be a JSON object"};
+
+    std::string file{get_string(s, "file")};
+    if (file.empty())
+      throw std::runtime_error{"missing \"file\" in series"};
+
+    std::string style{get_string(s, "style", "lines")};
+    if (std::find(styles.begin(), styles.end(), style) == styles.end())
+      throw std::runtime_error{"unknown style \"" + style + "\""};
+
+    if (i > 0)
+      os << ", ";
+    os << quote(file) << " using " << get_expression(s, "using", "1:2")
+       << " with " << style << " title " << quote(get_string(s, "title"));
+  }
+  os << "\n";
+
+  return os.str();
+}
+
+struct PendingJob {
+  size_t line_number;
+  std::string output;
+  GnuplotPool::Pending result;
+};
+
+struct Failure {
+  size_t line_number;
+  std::string reason;
+};
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+
+  size_t index{size_t(std::ceil(p / 100.0 * sorted.size()))};
+  return sorted[std::min(sorted.size(), std::max<size_t>(index, 1)) - 1];
+}
+
+int main(int argc, const char *argv[]) {
+  std::string executable{"gnuplot"};
+  size_t num_workers{};
+  double timeout{-1.0};
+  std::string input_file;
+
+  for (int i{1}; i < argc; ++i) {
+    std::string arg{argv[i]};
+    if (arg == "-n" && i + 1 < argc) {
+      num_workers = std::atoi(argv[++i]);
+    } else if (arg == "-g" && i + 1 < argc) {
+      executable = argv[++i];
+    } else if (arg == "-t" && i + 1 < argc) {
+      timeout = std::atof(argv[++i]);
+    } else if (arg[0] != '-' && input_file.empty()) {
+      input_file = arg;
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [-n NUM_WORKERS] [-g GNUPLOT] [-t SECONDS] [FILE]\n";
+      return 1;
+    }
+  }
+
+  std::ifstream file_stream;
+  if (!input_file.empty()) {
+    file_stream.open(input_file);
+    if (!file_stream) {
+      std::cerr << "Unable to open " << input_file << "\n";
+      return 1;
+    }
+  }
+  std::istream &input{input_file.empty() ? std::cin : file_stream};
+
+  auto start = std::chrono::steady_clock::now();
+  GnuplotPool pool{num_workers, executable};
+  pool.set_timeout(timeout);
+
+  std::deque<PendingJob> pending;
+  std::vector<double> latencies;
+  std::vector<Failure> failures;
+  size_t num_jobs{};
+
+  auto complete_job = [&]() {
+    PendingJob &job = pending.front();
+    GnuplotPool::Result result{job.result.get()};
+    latencies.push_back(result.seconds);
+    if (!result.ok)
+      failures.push_back(Failure{job.line_number,
+                                 "Gnuplot failed to produce " + job.output});
+    pending.pop_front();
+  };
+
+  std::string line;
+  size_t line_number{};
+  while (std::getline(input, line)) {
+    ++line_number;
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+
+    ++num_jobs;
+    try {
+      Json spec{JsonParser{line}.parse()};
+      std::string script{make_script(spec)};
+      pending.push_back(PendingJob{line_number, get_string(spec, "output"),
+                                   pool.submit(script)});
+    } catch (std::exception &exc) {
+      failures.push_back(Failure{line_number, exc.what()});
+    }
+
+    // Do not keep too many figures in memory
+    while (pending.size() > 4 * pool.size())
+      complete_job();
+  }
+
+  while (!pending.empty())
+    complete_job();
+
+  std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                        start};
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout << "Figures: " << num_jobs << " (" << failures.size()
+            << " failed)\n"
+            << "Gnuplot processes: " << pool.size() << "\n"
+            << "Elapsed time: " << elapsed.count() << " s\n"
+            << "Throughput: " << latencies.size() / elapsed.count()
+            << " figures/s\n";
+  if (!latencies.empty()) {
+    std::cout << "Latency [ms]: p50 = " << percentile(latencies, 50) * 1e3
+              << ", p90 = " << percentile(latencies, 90) * 1e3
+              << ", p99 = " << percentile(latencies, 99) * 1e3
+              << ", max = " << latencies.back() * 1e3 << "\n";
+  }
+
+  std::sort(failures.begin(), failures.end(),
+            [](const Failure &a, const Failure &b) {
+              return a.line_number < b.line_number;
+            });
+  for (const auto &failure : failures)
+    std::cout << "Line " << failure.line_number << ": " << failure.reason
+              << "\n";
+
+  return failures.empty() ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Replay a session recorded by Gnuplot::start_recording
+ *
+ * The commands are sent to a new Gnuplot process as fast as possible,
+ * waiting for each plot to be rendered, and the time spent sending
+ * commands and rendering plots is reported. With --null, the commands
+ * are sent to a process that discards them: comparing the two runs
+ * with the duration of the original session tells whether the time is
+ * spent in the library, in moving the data or in Gnuplot itself.
+ * Plots that are not rendered within the timeout (60 s by default)
+ * are reported as failures.
+ *
+ * Usage: gplotpp-replay [-g GNUPLOT | --null] [-t SECONDS] DIRECTORY
+ */
+
+#include "gplot++.h"
+#include <cstdlib>
+#include <iostream>
+
+struct Command {
+  long long timestamp_us;
+  std::string text;
+};
+
+struct Timing {
+  double seconds;
+  size_t index;
+};
+
+bool read_recording(const std::string &directory,
+                    std::vector<Command> &commands) {
+  std::ifstream in{directory + "/commands.log", std::ios::binary};
+  if (!in)
+    return false;
+
+  std::string header;
+  std::getline(in, header);
+  while (std::getline(in, header)) {
+    long long timestamp_us{};
+    size_t length{};
+    if (std::sscanf(header.c_str(), "%lld %zu", &timestamp_us, &length) != 2)
+      return false;
+
+    std::string text(length, '\0');
+    in.read(&text[0], length);
+    in.ignore(1); // Skip the newline
+
+    // Point to the copies of the data files
+    const std::string token{"@DATA@"};
+    size_t pos{};
+    while ((pos = text.find(token, pos)) != std::string::npos) {
+      text.replace(pos, token.size(), directory);
+      pos += directory.size();
+    }
+
+    commands.push_back(Command{timestamp_us, text});
+  }
+
+  return true;
+}
+
+size_t payload_size(const std::string &directory,
+                    const std::vector<Command> &commands) {
+  size_t total{};
+  std::vector<std::string> seen;
+  for (const auto &cmd : commands) {
+    size_t pos{};
+    const std::string prefix{"'" + directory + "/"};
+    while ((pos = cmd.text.find(prefix, pos)) != std::string::npos) {
+      size_t end{cmd.text.find('\'', pos + 1)};
+      std::string path{cmd.text.substr(pos + 1, end - pos - 1)};
+      if (std::find(seen.begin(), seen.end(), path) == seen.end()) {
+        seen.push_back(path);
+        std::ifstream file{path, std::ios::binary | std::ios::ate};
+        total += size_t(file.tellg());
+      }
+      pos = end;
+    }
+  }
+
+  return total;
+}
+
+// Return the position of the "plot" or "splot" command within a
+// command, or std::string::npos if there is none
+size_t find_plot(const std::string &command) {
+  size_t pos{0};
+  // Plot commands are usually preceded by other commands
+  while (true) {
+    if (command.compare(pos, 5, "plot ") == 0 ||
+        command.compare(pos, 6, "splot ") == 0)
+      return pos;
+
+    pos = command.find('\n', pos);
+    if (pos == std::string::npos)
+      return pos;
+    ++pos;
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  std::string executable{"gnuplot"};
+  std::string directory;
+  bool null_sink{false};
+  double timeout{60.0};
+
+  for (int i{1}; i < argc; ++i) {
+    std::string arg{argv[i]};
+    if (arg == "-g" && i + 1 < argc) {
+      executable = argv[++i];
+    } else if (arg == "--null") {
+      null_sink = true;
+    } else if (arg == "-t" && i + 1 < argc) {
+      timeout = std::atof(argv[++i]);
+    } else if (arg[0] != '-' && directory.empty()) {
+      directory = arg;
+    } else {
+      directory.clear();
+      break;
+    }
+  }
+
+  if (directory.empty()) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-g GNUPLOT | --null] [-t SECONDS] DIRECTORY\n";
+    return 1;
+  }
+
+  std::vector<Command> commands;
+  if (!read_recording(directory, commands)) {
+    std::cerr << "Unable to read the recording in " << directory << "\n";
+    return 1;
+  }
+
+  size_t command_bytes{};
+  for (const auto &cmd : commands)
+    command_bytes += cmd.text.size();
+
+  std::vector<Timing> renders;
+  size_t failures{};
+  double send_time{}, render_time{};
+  auto start = std::chrono::steady_clock::now();
+  {
+    Gnuplot plt{null_sink ? "cat > /dev/null" : executable.c_str(), false};
+
+    for (size_t i{}; i < commands.size(); ++i) {
+      auto t0 = std::chrono::steady_clock::now();
+      plt.sendcommand(commands[i].text);
+      auto t1 = std::chrono::steady_clock::now();
+      send_time += std::chrono::duration<double>(t1 - t0).count();
+
+      if (!null_sink && find_plot(commands[i].text) != std::string::npos) {
+        if (!plt.wait_until_rendered(timeout)) {
+          std::cerr << "Command #" << i + 1
+                    << " was not rendered: " << plt.last_error() << "\n";
+          ++failures;
+          continue;
+        }
+
+        double t = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t1)
+                       .count();
+        render_time += t;
+        renders.push_back(Timing{t, i});
+      }
+    }
+  }
+  double total{
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count()};
+
+  std::cout << "Commands: " << commands.size() << " (" << command_bytes
+            << " bytes)\n"
+            << "Data files: " << payload_size(directory, commands)
+            << " bytes\n";
+  if (!commands.empty())
+    std::cout << "Duration of the recorded session: "
+              << commands.back().timestamp_us * 1e-6 << " s\n";
+  std::cout << "Time spent sending commands: " << send_time << " s\n";
+  if (!null_sink)
+    std::cout << "Time spent rendering " << renders.size()
+              << " plots: " << render_time << " s\n";
+  std::cout << "Total replay time (including shutdown): " << total << " s\n";
+  if (failures > 0)
+    std::cout << "Plots not rendered: " << failures << "\n";
+
+  if (renders.empty())
+    return failures > 0 ? 1 : 0;
+
+  std::sort(renders.begin(), renders.end(),
+            [](const Timing &a, const Timing &b) {
+              return a.seconds > b.seconds;
+            });
+  std::cout << "Slowest plots:\n";
+  for (size_t i{}; i < std::min<size_t>(5, renders.size()); ++i) {
+    const std::string &text{commands[renders[i].index].text};
+    size_t start{find_plot(text)};
+    size_t end{std::min(text.find('\n', start), start + 100)};
+    std::cout << "  " << renders[i].seconds << " s: "
+              << text.substr(start, end - start) << "\n";
+  }
+}